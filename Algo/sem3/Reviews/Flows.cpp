@@ -7,6 +7,25 @@
 #include <functional>
 #include <list>
 #include <cassert>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <limits>
 
 class Network
 {
@@ -20,20 +39,23 @@ public:
         int finishVertex_ = NONE;
         int capacity_ = 0;
         int flow_ = 0;
+        int cost_ = 0;
 
         void clear() { flow_ = 0; }
     public:
         friend Network;
 
-        edge_t(int startVertex = NONE, int finishVertex = NONE, int capacity = NONE, int flow = 0)
+        edge_t(int startVertex = NONE, int finishVertex = NONE, int capacity = NONE, int flow = 0, int cost = 0)
             : startVertex_(startVertex)
             , finishVertex_(finishVertex)
             , capacity_(capacity)
             , flow_(flow)
+            , cost_(cost)
         {}
         int startVertex() const { return startVertex_; }
         int finishVertex() const { return finishVertex_; }
         int capacity() const { return capacity_; }
+        int cost() const { return cost_; }
         int& flow() { return flow_; }
         int flow() const { return flow_; }
 
@@ -52,11 +74,11 @@ private:
     int                     source_;
     int                     sink_;
 
-    void insertEdgeImpl(int startVertex, int finishVertex, int capacity)
+    void insertEdgeImpl(int startVertex, int finishVertex, int capacity, int cost = 0)
     {
         previousEdge_.push_back(lastEdge_.at(startVertex));
         lastEdge_.at(startVertex) = static_cast<int>(edges_.size());
-        edges_.push_back({startVertex, finishVertex, capacity});
+        edges_.push_back({startVertex, finishVertex, capacity, 0, cost});
     }
 public:
     Network() = default;
@@ -67,10 +89,51 @@ public:
         , sink_(sink)
     {}
 
-    void insertEdge(int startVertex, int finishVertex, int capacity, bool isDirected = true)
+    // empties the network for N vertices, keeping the allocated buffers
+    void assign(size_t N, int source, int sink)
+    {
+        lastEdge_.assign(N, NONE);
+        previousEdge_.clear();
+        edges_.clear();
+        source_ = source;
+        sink_ = sink;
+    }
+
+    void reserveEdges(size_t edgesCount)
+    {
+        previousEdge_.reserve(edgesCount);
+        edges_.reserve(edgesCount);
+    }
+
+    int insertEdge(int startVertex, int finishVertex, int capacity, bool isDirected = true)
     {
         insertEdgeImpl(startVertex, finishVertex, capacity);
         insertEdgeImpl(finishVertex, startVertex, isDirected ? 0 : capacity);
+        return static_cast<int>(edges_.size()) - 2;
+    }
+
+    // edge pair with arbitrary capacities in both directions, e.g. to copy an existing one
+    int insertEdgePair(int startVertex, int finishVertex, int capacity, int backCapacity, int cost = 0)
+    {
+        insertEdgeImpl(startVertex, finishVertex, capacity, cost);
+        insertEdgeImpl(finishVertex, startVertex, backCapacity, -cost);
+        return static_cast<int>(edges_.size()) - 2;
+    }
+
+    // directed edge with a cost per unit of flow, its back edge costs -cost
+    int insertCostEdge(int startVertex, int finishVertex, int capacity, int cost)
+    {
+        insertEdgeImpl(startVertex, finishVertex, capacity, cost);
+        insertEdgeImpl(finishVertex, startVertex, 0, -cost);
+        return static_cast<int>(edges_.size()) - 2;
+    }
+
+    void setCapacity(int edgeId, int capacity) { edges_.at(edgeId).capacity_ = capacity; }
+
+    void pushFlow(int edgeId, int flow)
+    {
+        edges_.at(edgeId).flow_ += flow;
+        edges_.at(edgeId ^ 1).flow_ -= flow;
     }
 private:
     template <bool isBackEdgeIterator>
@@ -177,6 +240,10 @@ public:
     auto vertexBackEdgeList(int vertex) { return view_t<BackEdgeIterator>{{&edges_, &previousEdge_, lastEdge_.at(vertex)}, {}};}
 
     size_t size() const { return lastEdge_.size(); }
+    size_t edgesCount() const { return edges_.size(); }
+
+    edge_t& edge(int edgeId) { return edges_.at(edgeId); }
+    const edge_t& edge(int edgeId) const { return edges_.at(edgeId); }
 
     void clear()
     {
@@ -186,6 +253,361 @@ public:
 
     int source() const { return source_; }
     int sink() const { return sink_; }
+
+    void setTerminals(int source, int sink)
+    {
+        source_ = source;
+        sink_ = sink;
+    }
+};
+
+/*
+ * Per-run solver counters and phase timers, only collected when built with -DFLOW_STATS.
+ * Otherwise FLOW_STAT(...) expands to nothing and stats() stays zero.
+ */
+#ifdef FLOW_STATS
+#define FLOW_STAT(action) action
+#else
+#define FLOW_STAT(action)
+#endif
+
+/*
+ * Heap allocations of the current thread, only counted when built with -DFLOW_ALLOCATION_CHECK.
+ * BatchSolver then aborts if a worker allocates on an instance no larger than one it has solved.
+ */
+#ifdef FLOW_ALLOCATION_CHECK
+thread_local size_t threadAllocations = 0;
+
+void* operator new(size_t size)
+{
+    ++threadAllocations;
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+// kept out of line, inlined into a new-expression GCC takes free() for a mismatched deallocation
+[[gnu::noinline]] void operator delete(void* pointer) noexcept { std::free(pointer); }
+
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+#endif
+
+struct SolverStats
+{
+    using duration_t = std::chrono::steady_clock::duration;
+
+#ifdef FLOW_STATS
+    constexpr static bool enabled = true;
+#else
+    constexpr static bool enabled = false;
+#endif
+
+    long long phases = 0;
+    long long bfsRuns = 0;
+    long long referenceVertices = 0;
+    long long saturatingPushes = 0;
+    long long nonSaturatingPushes = 0;
+    long long relabels = 0;
+    long long discharges = 0;
+    long long globalRelabels = 0;
+
+    duration_t levelGraphTime = duration_t::zero();
+    duration_t blockingFlowTime = duration_t::zero();
+    duration_t dischargeTime = duration_t::zero();
+    duration_t globalRelabelTime = duration_t::zero();
+
+    long long pushes() const { return saturatingPushes + nonSaturatingPushes; }
+
+    void countPush(bool isSaturating) { ++(isSaturating ? saturatingPushes : nonSaturatingPushes); }
+
+    SolverStats& operator+=(const SolverStats& other)
+    {
+        phases += other.phases;
+        bfsRuns += other.bfsRuns;
+        referenceVertices += other.referenceVertices;
+        saturatingPushes += other.saturatingPushes;
+        nonSaturatingPushes += other.nonSaturatingPushes;
+        relabels += other.relabels;
+        discharges += other.discharges;
+        globalRelabels += other.globalRelabels;
+        levelGraphTime += other.levelGraphTime;
+        blockingFlowTime += other.blockingFlowTime;
+        dischargeTime += other.dischargeTime;
+        globalRelabelTime += other.globalRelabelTime;
+        return *this;
+    }
+
+    // adds the lifetime of the scope to one of the timers
+    class PhaseTimer
+    {
+    private:
+        duration_t& total_;
+        std::chrono::steady_clock::time_point start_;
+    public:
+        explicit PhaseTimer(duration_t& total)
+            : total_(total)
+            , start_(std::chrono::steady_clock::now())
+        {}
+        ~PhaseTimer() { total_ += std::chrono::steady_clock::now() - start_; }
+    };
+};
+
+/*
+ * Level-synchronous BFS over a Network for level graphs and height labels. Top-down steps expand
+ * the frontier and claim vertices with atomic compare-exchange, bottom-up steps let every unvisited
+ * vertex look for a parent in the frontier; the direction switches when the frontier's edges
+ * outnumber the unexplored ones (Beamer et al.). Levels with little work stay on the calling thread.
+ * isAllowed(edgeId) selects the traversable edges, edgeId always points away from the root
+ * (FromRoot) or towards it (ToRoot).
+ */
+class ParallelBfs
+{
+public:
+    enum class Direction { FromRoot, ToRoot };
+private:
+    constexpr static size_t SEQUENTIAL_WORK_SIZE = 1024;
+    // lower than the usual 14: in residual networks many of the scanned edges are saturated
+    constexpr static long long BOTTOM_UP_FACTOR = 4;
+    constexpr static long long TOP_DOWN_FACTOR = 24;
+
+    // workers for threads 1.., parked between parallelFor calls, the caller runs chunk 0 itself
+    struct pool_t
+    {
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable started, finished;
+        size_t generation = 0;
+        size_t running = 0;
+        bool isStopping = false;
+        void (*task)(void* context, size_t threadId) = nullptr;
+        void* context = nullptr;
+
+        explicit pool_t(size_t threadsCount)
+        {
+            for (size_t threadId(1); threadId < threadsCount; ++threadId)
+                threads.emplace_back([this, threadId]() { work(threadId); });
+        }
+
+        ~pool_t()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                isStopping = true;
+            }
+            started.notify_all();
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        void work(size_t threadId)
+        {
+            size_t seenGeneration(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                started.wait(lock, [&]() { return isStopping || generation != seenGeneration; });
+                if (isStopping)
+                    return;
+                seenGeneration = generation;
+                lock.unlock();
+                task(context, threadId);
+                lock.lock();
+                if (--running == 0)
+                    finished.notify_one();
+            }
+        }
+
+        // chunk(threadId) on every thread, returns when all of them are done
+        template <typename Chunk>
+        void run(Chunk& chunk)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = [](void* context, size_t threadId) { (*static_cast<Chunk*>(context))(threadId); };
+                context = &chunk;
+                running = threads.size();
+                ++generation;
+            }
+            started.notify_all();
+            chunk(0);
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&]() { return running == 0; });
+        }
+    };
+
+    size_t threadsCount_;
+    std::unique_ptr<pool_t> pool_;
+    Network* network_ = nullptr;
+    size_t size_ = 0;
+    std::vector<std::atomic<int>> distance_;
+    std::vector<int> degree_;
+    std::vector<int> frontier_;
+    std::vector<std::vector<int>> nextFrontiers_;
+    long long unexploredEdges_ = 0;
+
+    // body(index, threadId) for every index below count, split in contiguous chunks among threads
+    template <typename Body>
+    void parallelFor(size_t count, Body body)
+    {
+        if (count < SEQUENTIAL_WORK_SIZE || threadsCount_ == 1)
+        {
+            for (size_t index(0); index < count; ++index)
+                body(index, 0);
+            return;
+        }
+        if (!pool_)
+            pool_ = std::make_unique<pool_t>(threadsCount_);
+        size_t chunkSize((count + threadsCount_ - 1) / threadsCount_);
+        auto chunk = [&](size_t threadId)
+        {
+            size_t first(std::min(count, threadId * chunkSize));
+            size_t last(std::min(count, first + chunkSize));
+            for (size_t index(first); index < last; ++index)
+                body(index, threadId);
+        };
+        pool_->run(chunk);
+    }
+
+    template <typename Filter>
+    void topDownStep(int level, Direction direction, Filter& isAllowed)
+    {
+        parallelFor(frontier_.size(), [&](size_t index, size_t threadId)
+        {
+            int vertex(frontier_.at(index));
+            auto visit = [&](int edgeId, int nextVertex)
+            {
+                int unvisited(Network::NONE);
+                if (distance_.at(nextVertex).load(std::memory_order_relaxed) == Network::NONE && isAllowed(edgeId)
+                        && distance_.at(nextVertex).compare_exchange_strong(unvisited, level + 1, std::memory_order_relaxed))
+                    nextFrontiers_.at(threadId).push_back(nextVertex);
+            };
+            if (direction == Direction::FromRoot)
+            {
+                auto edges = network_->vertexEdgeList(vertex);
+                for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+                    visit(edge.getEdgeId(), edge->finishVertex());
+            }
+            else
+            {
+                auto edges = network_->vertexBackEdgeList(vertex);
+                for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+                    visit(edge.getEdgeId(), edge->startVertex());
+            }
+        });
+    }
+
+    template <typename Filter>
+    void bottomUpStep(int level, Direction direction, Filter& isAllowed)
+    {
+        parallelFor(size_, [&](size_t index, size_t threadId)
+        {
+            int vertex(static_cast<int>(index));
+            if (distance_.at(vertex).load(std::memory_order_relaxed) != Network::NONE)
+                return;
+            auto tryParent = [&](int edgeId, int parent)
+            {
+                if (distance_.at(parent).load(std::memory_order_relaxed) != level || !isAllowed(edgeId))
+                    return false;
+                distance_.at(vertex).store(level + 1, std::memory_order_relaxed);
+                nextFrontiers_.at(threadId).push_back(vertex);
+                return true;
+            };
+            if (direction == Direction::FromRoot)
+            {
+                auto edges = network_->vertexBackEdgeList(vertex);
+                for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+                    if (tryParent(edge.getEdgeId(), edge->startVertex()))
+                        break;
+            }
+            else
+            {
+                auto edges = network_->vertexEdgeList(vertex);
+                for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+                    if (tryParent(edge.getEdgeId(), edge->finishVertex()))
+                        break;
+            }
+        });
+    }
+public:
+    // single-threaded unless asked otherwise, solvers often run inside worker threads already
+    explicit ParallelBfs(size_t threadsCount = 1)
+        : threadsCount_(std::max<size_t>(threadsCount, 1))
+        , nextFrontiers_(threadsCount_)
+    {}
+
+    // the workers are started by the first level big enough to be split
+    void setThreadsCount(size_t threadsCount)
+    {
+        pool_.reset();
+        threadsCount_ = std::max<size_t>(threadsCount, 1);
+        nextFrontiers_.resize(threadsCount_);
+    }
+
+    // to be called whenever the edge set of the network changes, buffers only grow
+    void attach(Network& network)
+    {
+        network_ = &network;
+        size_ = network.size();
+        if (distance_.size() < size_)
+            distance_ = std::vector<std::atomic<int>>(size_);
+        degree_.assign(size_, 0);
+        for (const auto& edge : network)
+            ++degree_.at(edge.startVertex());
+        // a level holds every vertex at most, so searches never grow the frontiers
+        frontier_.reserve(size_);
+        for (auto& nextFrontier : nextFrontiers_)
+            nextFrontier.reserve(size_);
+    }
+
+    // marks every vertex unvisited
+    void clear()
+    {
+        for (size_t vertex(0); vertex < size_; ++vertex)
+            distance_.at(vertex).store(Network::NONE, std::memory_order_relaxed);
+        unexploredEdges_ = static_cast<long long>(network_->edgesCount());
+    }
+
+    /*
+     * Visits the vertices reachable from root (or reaching it) that are still unvisited,
+     * root gets rootDistance. Several searches between clear() calls extend each other,
+     * a later one has to start beyond the distances reached by the earlier ones.
+     */
+    template <typename Filter>
+    void search(int root, int rootDistance, Direction direction, Filter isAllowed)
+    {
+        distance_.at(root).store(rootDistance, std::memory_order_relaxed);
+        frontier_.assign(1, root);
+        unexploredEdges_ -= degree_.at(root);
+        long long frontierEdges(degree_.at(root));
+        size_t previousFrontierSize(0);
+        bool isBottomUp(false);
+        for (int level(rootDistance); !frontier_.empty(); ++level)
+        {
+            bool isGrowing(frontier_.size() > previousFrontierSize);
+            if (!isBottomUp && isGrowing && frontierEdges * BOTTOM_UP_FACTOR > unexploredEdges_)
+                isBottomUp = true;
+            else if (isBottomUp && !isGrowing
+                    && static_cast<long long>(frontier_.size()) * TOP_DOWN_FACTOR < static_cast<long long>(size_))
+                isBottomUp = false;
+            previousFrontierSize = frontier_.size();
+            if (isBottomUp)
+                bottomUpStep(level, direction, isAllowed);
+            else
+                topDownStep(level, direction, isAllowed);
+            frontier_.clear();
+            frontierEdges = 0;
+            for (auto& nextFrontier : nextFrontiers_)
+            {
+                for (int vertex : nextFrontier)
+                    frontierEdges += degree_.at(vertex);
+                frontier_.insert(frontier_.end(), nextFrontier.begin(), nextFrontier.end());
+                nextFrontier.clear();
+            }
+            unexploredEdges_ -= frontierEdges;
+        }
+    }
+
+    int distance(int vertex) const { return distance_.at(vertex).load(std::memory_order_relaxed); }
 };
 
 class FlowFindingAlgorithm
@@ -193,23 +615,314 @@ class FlowFindingAlgorithm
 protected:
     Network network_;
     int result_ = 0;
+    SolverStats stats_;
     size_t size_ = 0;
     bool networkLoaded_ = false;
+    const std::atomic<bool>* cancelFlag_ = nullptr;
+
+    // reused between runs so that solving a loaded network allocates nothing once warmed up
+    std::vector<int> bfsQueue_;
+    std::vector<bool> sourceSide_;
+    std::vector<long long> excess_;
+    std::vector<int> imbalance_, parentEdge_, routeTargets_;
+    ParallelBfs bfs_;
 
     bool checkNetwork() { return networkLoaded_; }
+
+    const std::vector<bool>& markSourceSide()
+    {
+        sourceSide_.assign(size_, true);
+        bfsQueue_.assign(1, network_.sink());
+        sourceSide_.at(network_.sink()) = false;
+        for (size_t head(0); head < bfsQueue_.size(); ++head)
+        {
+            int vertex(bfsQueue_.at(head));
+            for (const Network::edge_t& edge : network_.vertexBackEdgeList(vertex))
+                if (edge.residualCapacity() > 0 && sourceSide_.at(edge.startVertex()))
+                {
+                    sourceSide_.at(edge.startVertex()) = false;
+                    bfsQueue_.push_back(edge.startVertex());
+                }
+        }
+        return sourceSide_;
+    }
+
+    // main loops poll it and make run() return false as soon as the owner raises the flag
+    bool isCancelled() const { return cancelFlag_ != nullptr && cancelFlag_->load(std::memory_order_relaxed); }
+
+    int flowValue()
+    {
+        int value(0);
+        for (const Network::edge_t& edge : network_.vertexEdgeList(network_.source()))
+            value += edge.flow();
+        return value;
+    }
+
+    /*
+     * BFS over residual edges from vertex (against them if isReversed). Terminals and, for excesses,
+     * vertices with a deficit are collected to routeTargets_ in BFS order and not expanded further.
+     */
+    void findRoutes(int vertex, bool isReversed)
+    {
+        parentEdge_.assign(size_, Network::NONE);
+        routeTargets_.clear();
+        bfsQueue_.assign(1, vertex);
+        for (size_t head(0); head < bfsQueue_.size(); ++head)
+        {
+            int current(bfsQueue_.at(head));
+            auto visit = [&](int edgeId, int nextVertex)
+            {
+                if (nextVertex == vertex || parentEdge_.at(nextVertex) != Network::NONE
+                        || network_.edge(edgeId).residualCapacity() <= 0)
+                    return;
+                parentEdge_.at(nextVertex) = edgeId;
+                if (nextVertex == network_.source() || nextVertex == network_.sink()
+                        || (!isReversed && imbalance_.at(nextVertex) < 0))
+                    routeTargets_.push_back(nextVertex);
+                else
+                    bfsQueue_.push_back(nextVertex);
+            };
+            if (isReversed)
+            {
+                for (auto edge = network_.vertexBackEdgeList(current).begin(); edge; ++edge)
+                    visit(edge.getEdgeId(), edge->startVertex());
+            }
+            else
+            {
+                for (auto edge = network_.vertexEdgeList(current).begin(); edge; ++edge)
+                    visit(edge.getEdgeId(), edge->finishVertex());
+            }
+        }
+    }
+
+    // pushes along the BFS tree path between vertex and target, 0 if earlier pushes saturated it
+    int pushRoute(int vertex, int target, bool isReversed)
+    {
+        int flow(std::abs(imbalance_.at(vertex)));
+        if (target != network_.source() && target != network_.sink())
+            flow = std::min(flow, -imbalance_.at(target));
+        for (int current(target); current != vertex && flow > 0; )
+        {
+            const Network::edge_t& edge = network_.edge(parentEdge_.at(current));
+            flow = std::min(flow, edge.residualCapacity());
+            current = isReversed ? edge.finishVertex() : edge.startVertex();
+        }
+        if (flow <= 0)
+            return 0;
+        for (int current(target); current != vertex; )
+        {
+            network_.pushFlow(parentEdge_.at(current), flow);
+            const Network::edge_t& edge = network_.edge(parentEdge_.at(current));
+            current = isReversed ? edge.finishVertex() : edge.startVertex();
+        }
+        imbalance_.at(vertex) += isReversed ? flow : -flow;
+        if (target != network_.source() && target != network_.sink())
+            imbalance_.at(target) += flow;
+        return flow;
+    }
+
+    /*
+     * Pushes vertex's excess (deficit if isReversed) to terminals or to vertices with the opposite
+     * imbalance. One BFS serves every path its tree still has room on, it's repeated only when they are used up.
+     */
+    void routeImbalance(int vertex, bool isReversed)
+    {
+        while (imbalance_.at(vertex) != 0)
+        {
+            findRoutes(vertex, isReversed);
+            int routed(0);
+            for (size_t index(0); index < routeTargets_.size() && imbalance_.at(vertex) != 0; ++index)
+                routed += pushRoute(vertex, routeTargets_.at(index), isReversed);
+            if (routed == 0)
+                return;
+        }
+    }
+
+    /*
+     * Turns the stored flow back into a feasible one after capacities were decreased:
+     * clips overflowing edges, cancels the resulting excesses against deficits or returns them
+     * to the terminals, then pulls the remaining deficits from the terminals.
+     */
+    void repairFlow()
+    {
+        imbalance_.assign(size_, 0);
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); ++edgeId)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            int overflow(edge.flow() - edge.capacity());
+            if (overflow <= 0)
+                continue;
+            imbalance_.at(edge.startVertex()) += overflow;
+            imbalance_.at(edge.finishVertex()) -= overflow;
+            network_.pushFlow(edgeId, -overflow);
+        }
+        imbalance_.at(network_.source()) = imbalance_.at(network_.sink()) = 0;
+        for (size_t vertex(0); vertex < size_; ++vertex)
+            if (imbalance_.at(vertex) > 0)
+                routeImbalance(static_cast<int>(vertex), false);
+        for (size_t vertex(0); vertex < size_; ++vertex)
+            if (imbalance_.at(vertex) < 0)
+                routeImbalance(static_cast<int>(vertex), true);
+        result_ = flowValue();
+    }
 public:
     FlowFindingAlgorithm() = default;
+    virtual ~FlowFindingAlgorithm() = default;
 
     int result() { return result_; }
-    void reset() { network_.clear(); result_ = 0; }
+    const SolverStats& stats() const { return stats_; }
+    void reset() { network_.clear(); result_ = 0; stats_ = {}; }
+
+    void loadNetwork(Network&& network)
+    {
+        network_ = std::move(network);
+        size_ = network_.size();
+        networkLoaded_ = true;
+        // every vertex enters a BFS queue once at most
+        bfsQueue_.reserve(size_);
+        routeTargets_.reserve(size_);
+    }
 
-    void loadNetwork(Network&& network) { network_ = std::move(network); size_ = network_.size(); networkLoaded_ = true; }
+    void setCancelFlag(const std::atomic<bool>* cancelFlag) { cancelFlag_ = cancelFlag; }
+    // threads of the BFS behind level graphs and global relabels, 1 by default
+    void setBfsThreads(size_t threadsCount) { bfs_.setThreadsCount(threadsCount); }
     void storeNetwork(Network& network) { network = std::move(network_); size_ = 0; networkLoaded_ = false; }
+    const Network& network() const { return network_; }
+
+    /*
+     * Incremental interface: change the loaded (usually already solved) network
+     * and call rerun() to repair the current flow and augment it to a maximal one.
+     */
+    void updateCapacity(int edgeId, int capacity) { network_.setCapacity(edgeId, capacity); }
+
+    int insertEdge(int startVertex, int finishVertex, int capacity, bool isDirected = true)
+    {
+        return network_.insertEdge(startVertex, finishVertex, capacity, isDirected);
+    }
+
+    bool rerun()
+    {
+        if (!checkNetwork())
+            return false;
+        repairFlow();
+        return resume();
+    }
+
+    /*
+     * Source side of a minimum cut: vertices that can't reach the sink in the residual network.
+     * Valid for maximum preflows too.
+     */
+    std::vector<bool> minCut() { return markSourceSide(); }
+
+    /*
+     * O(V + E) optimality certificate of the stored flow: capacity constraints, antisymmetry,
+     * conservation (or non-negative excesses for a preflow), and a residual cut whose capacity equals result().
+     */
+    bool verifyFlow(bool allowPreflow = false)
+    {
+        if (!checkNetwork())
+            return false;
+        excess_.assign(size_, 0);
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); ++edgeId)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            if (edge.flow() > edge.capacity() || edge.flow() != -network_.edge(edgeId ^ 1).flow())
+                return false;
+            excess_.at(edge.finishVertex()) += edge.flow();
+        }
+        excess_.at(network_.source()) = 0;
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            if (vertex != network_.sink() && (excess_.at(vertex) < 0 || (!allowPreflow && excess_.at(vertex) > 0)))
+                return false;
+        if (excess_.at(network_.sink()) != result_)
+            return false;
+
+        const std::vector<bool>& sourceSide = markSourceSide();
+        if (!sourceSide.at(network_.source()))
+            return false;
+        long long cutCapacity(0);
+        for (const auto& edge : network_)
+            if (sourceSide.at(edge.startVertex()) && !sourceSide.at(edge.finishVertex()))
+                cutCapacity += edge.capacity();
+        return cutCapacity == result_;
+    }
 
     virtual bool run() = 0;
+
+    // continues from the flow stored in the network, algorithms without warm start solve from scratch
+    virtual bool resume() { return run(); }
+};
+
+/*
+ * Common driver of the level-graph solvers. With capacity scaling a phase with scale delta_ sees
+ * the residual capacities rounded down to multiples of delta_, so edges below delta_ are ignored and
+ * every push moves a multiple of delta_; delta_ starts at the largest power of two not above the
+ * maximal capacity and is halved when the sink becomes unreachable, the last scale 1 is exact.
+ */
+class LevelGraphAlgorithm : public FlowFindingAlgorithm
+{
+private:
+    bool capacityScaling_ = false;
+
+    // no augmenting path carries more than the widest residual edge leaving the source or entering the sink
+    int initialDelta()
+    {
+        int maxCapacity(1);
+        if (capacityScaling_)
+        {
+            int sourceCapacity(0), sinkCapacity(0);
+            for (const auto& edge : network_.vertexEdgeList(network_.source()))
+                sourceCapacity = std::max(sourceCapacity, edge.residualCapacity());
+            for (const auto& edge : network_.vertexBackEdgeList(network_.sink()))
+                sinkCapacity = std::max(sinkCapacity, edge.residualCapacity());
+            maxCapacity = std::max(maxCapacity, std::min(sourceCapacity, sinkCapacity));
+        }
+        int delta(1);
+        while (delta <= maxCapacity / 2)
+            delta *= 2;
+        return delta;
+    }
+protected:
+    int delta_ = 1;
+
+    int usableCapacity(const Network::edge_t& edge) const
+    {
+        return edge.residualCapacity() - edge.residualCapacity() % delta_;
+    }
+
+    virtual void prepare() = 0;
+
+    // runs phases until the sink is unreachable at the current scale, false if cancelled
+    virtual bool runPhases() = 0;
+public:
+    void setCapacityScaling(bool capacityScaling) { capacityScaling_ = capacityScaling; }
+
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
+        result_ = flowValue();
+        prepare();
+        for (delta_ = initialDelta(); delta_ > 0; delta_ /= 2)
+            if (!runPhases())
+            {
+                delta_ = 1;
+                return false;
+            }
+        delta_ = 1;
+        return true;
+    }
 };
 
-class MalhotraKumarMaheshwari : public FlowFindingAlgorithm
+class MalhotraKumarMaheshwari : public LevelGraphAlgorithm
 {
 private:
     std::vector<int>
@@ -228,7 +941,7 @@ private:
 
     int phi(int vertex) const { return std::min(incomePhi_.at(vertex), outcomePhi_.at(vertex)); }
 
-    void prepare()
+    void prepare() final
     {
         incomePhi_.resize(size_);
         outcomePhi_.resize(size_);
@@ -238,24 +951,16 @@ private:
         vertexStates_.resize(size_);
         verticesToDelete_.clear();
         addedFlow_.resize(size_);
+        bfs_.attach(network_);
     }
 
     void buildSlices()
     {
-        std::queue<int> bfsQueue({network_.source()});
-        slice_.assign(size_, size_);
-        slice_.at(network_.source()) = 0;
-        while (!bfsQueue.empty())
-        {
-            int vertex(bfsQueue.front());
-            bfsQueue.pop();
-            for (const Network::edge_t& edge : network_.vertexEdgeList(vertex))
-                if (edge.residualCapacity() > 0 && slice_.at(edge.goThroughEdge(vertex)) == size_)
-                {
-                    bfsQueue.push(edge.goThroughEdge(vertex));
-                    slice_.at(edge.goThroughEdge(vertex)) = slice_.at(vertex) + 1;
-                }
-        }
+        bfs_.clear();
+        bfs_.search(network_.source(), 0, ParallelBfs::Direction::FromRoot,
+                [this](int edgeId) { return usableCapacity(network_.edge(edgeId)) > 0; });
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            slice_.at(vertex) = bfs_.distance(vertex) == Network::NONE ? size_ : bfs_.distance(vertex);
     }
 
     void markInvalidVertex(int vertex)
@@ -278,14 +983,14 @@ private:
                 if (isValidEdge(edge))
                 {
                     int nextVertex(edge.goThroughEdge(vertex));
-                    if ((incomePhi_.at(nextVertex) -= edge.residualCapacity()) == 0)
+                    if ((incomePhi_.at(nextVertex) -= usableCapacity(edge)) == 0)
                         markInvalidVertex(nextVertex);
                 }
             for (const Network::edge_t& edge : backEdgeLists_.at(vertex))
                 if (isValidEdge(edge))
                 {
                     int prevVertex(edge.goThroughEdge(vertex));
-                    if ((outcomePhi_.at(prevVertex) -= edge.residualCapacity()) == 0)
+                    if ((outcomePhi_.at(prevVertex) -= usableCapacity(edge)) == 0)
                         markInvalidVertex(prevVertex);
                 }
         }
@@ -293,28 +998,20 @@ private:
 
     void validateSlices()
     {
-        std::queue<int> bfsQueue({network_.sink()});
-        std::vector<bool> visited(size_, false);
-        visited.at(network_.sink()) = true;
-        while (!bfsQueue.empty())
+        bfs_.clear();
+        bfs_.search(network_.sink(), 0, ParallelBfs::Direction::ToRoot, [this](int edgeId)
         {
-            int vertex(bfsQueue.front());
-            bfsQueue.pop();
-            for (const Network::edge_t& edge : network_.vertexBackEdgeList(vertex))
-                if (edge.residualCapacity() > 0 && slice_.at(edge.goThroughEdge(vertex)) == slice_.at(vertex) - 1)
-                {
-                    visited.at(edge.goThroughEdge(vertex)) = true;
-                    bfsQueue.push(edge.goThroughEdge(vertex));
-                }
-        }
+            const Network::edge_t& edge = network_.edge(edgeId);
+            return usableCapacity(edge) > 0 && slice_.at(edge.startVertex()) == slice_.at(edge.finishVertex()) - 1;
+        });
         for (int vertex(0); vertex < size_; ++vertex)
-            if (!visited.at(vertex))
+            if (bfs_.distance(vertex) == Network::NONE)
                 markInvalidVertex(vertex);
     }
 
     bool isValidEdge(const Network::edge_t& edge) const
     {
-        return edge.residualCapacity() > 0 && slice_.at(edge.finishVertex()) == slice_.at(edge.startVertex()) + 1;
+        return usableCapacity(edge) > 0 && slice_.at(edge.finishVertex()) == slice_.at(edge.startVertex()) + 1;
     }
     
     template <class EdgeIterator>
@@ -322,7 +1019,7 @@ private:
     {
         for (const Network::edge_t& edge : edges)
             if (isValidEdge(edge))
-                partialPhi += edge.residualCapacity();
+                partialPhi += usableCapacity(edge);
     }
     
     void initializePhi()
@@ -343,8 +1040,11 @@ private:
             calcPartialPhi(incomePhi_.at(vertex), network_.vertexBackEdgeList(vertex));
         }
 
-        outcomePhi_.at(network_.sink()) = Network::INF;
-        incomePhi_.at(network_.source()) = Network::INF;
+        // the terminals must never limit a phase, and their phi has to stay a multiple of delta_ like every
+        // other phi, otherwise the minimal phi could be rounded away and a push would run out of edges
+        int terminalPhi(std::numeric_limits<int>::max() - std::numeric_limits<int>::max() % delta_);
+        outcomePhi_.at(network_.sink()) = terminalPhi;
+        incomePhi_.at(network_.source()) = terminalPhi;
     }
 
     bool prepareIteration()
@@ -378,7 +1078,7 @@ private:
     int maxPossibleFlowThroughEdge(int currentVertex, const Network::edge_t& edge) const
     {
         int nextVertex(edge.goThroughEdge(currentVertex));
-        return std::min(edge.residualCapacity(), phi(nextVertex));
+        return std::min(usableCapacity(edge), phi(nextVertex));
     }
 
     template <typename EdgeIterator>
@@ -388,11 +1088,10 @@ private:
             std::vector<int>& secondPhi)
     {
         addedFlow_.at(referencedVertex) = flow;
-        std::queue<int> bfsQueue({referencedVertex});
-        while (!bfsQueue.empty())
+        bfsQueue_.assign(1, referencedVertex);
+        for (size_t head(0); head < bfsQueue_.size(); ++head)
         {
-            int vertex(bfsQueue.front());
-            bfsQueue.pop();
+            int vertex(bfsQueue_.at(head));
             secondPhi.at(vertex) -= addedFlow_.at(vertex);
             if (vertex != finishVertex)
                 while (addedFlow_.at(vertex) > 0)
@@ -408,8 +1107,9 @@ private:
                         continue;
                     }
                     if (addedFlow_.at(nextVertex) == 0)
-                        bfsQueue.push(nextVertex);
+                        bfsQueue_.push_back(nextVertex);
                     addedFlow_.at(nextVertex) += currentFlow;
+                    FLOW_STAT(stats_.countPush(currentFlow == usableCapacity(edge)));
                     edgeLists.at(vertex).begin().pushFlow(currentFlow);
                     firstPhi.at(nextVertex) -= currentFlow;
                     addedFlow_.at(vertex) -= currentFlow;
@@ -422,12 +1122,13 @@ private:
 
     void doIteration()
     {
-        for (int flowPushingIteration(0); flowPushingIteration < size_; ++flowPushingIteration)
+        for (int flowPushingIteration(0); flowPushingIteration < size_ && !isCancelled(); ++flowPushingIteration)
         {
             addedFlow_.assign(size_, 0);
             int referencedVertex(findVertexWithMinimalPhi());
             if (referencedVertex == Network::NONE)
                 return;
+            FLOW_STAT(++stats_.referenceVertices);
             int flow(phi(referencedVertex));
             result_ += flow;
             pushFlow(referencedVertex, network_.sink(), flow, edgeLists_, incomePhi_, outcomePhi_);
@@ -435,28 +1136,579 @@ private:
             deleteInvalidVertices();
         }
     }
-public:
-    bool run() final
+
+    bool runPhases() final
     {
-        if (!checkNetwork())
-            return false;
-        reset();
-        prepare();
         for (int iteration(0); iteration <= size_; ++iteration)
         {
-            if (!prepareIteration())
-                break;
-            doIteration();
+            {
+                FLOW_STAT(SolverStats::PhaseTimer timer(stats_.levelGraphTime));
+                FLOW_STAT(stats_.bfsRuns += 2);
+                if (!prepareIteration())
+                    break;
+            }
+            FLOW_STAT(++stats_.phases);
+            {
+                FLOW_STAT(SolverStats::PhaseTimer timer(stats_.blockingFlowTime));
+                doIteration();
+            }
+            if (isCancelled())
+                return false;
         }
         return true;
     }
 };
 
-class PreflowPushAlgorithm : public FlowFindingAlgorithm
+/*
+ * Dinic with Sleator-Tarjan dynamic trees, O(VE log V): inside a phase the admissible edges found so far
+ * form a forest stored in a link-cut tree, so a path to the sink is extended, augmented and saturated
+ * edges are cut in O(log V) amortized instead of walking the path again.
+ * The value of a tree node is the residual capacity of the edge to its parent, the flow is
+ * written back to the network when that edge is cut. Nodes live in one flat vector indexed by vertex.
+ */
+class DynamicTreeDinic : public LevelGraphAlgorithm
 {
 private:
-    std::vector<int> height_, overage_;
-    std::vector<Network::view_t<Network::EdgeIterator>> edgeLists_;
+    constexpr static long long INF_VALUE = std::numeric_limits<long long>::max() / 4;
+
+    // splay tree node of the link-cut tree, parent is the path-parent for splay roots
+    struct node_t
+    {
+        int left = Network::NONE;
+        int right = Network::NONE;
+        int parent = Network::NONE;
+        long long value = INF_VALUE;
+        long long minimum = INF_VALUE;
+        long long lazyAdd = 0;
+    };
+
+    std::vector<node_t> nodes_;
+    std::vector<int> level_, parentEdge_, linkedCapacity_, splayPath_;
+    std::vector<Network::view_t<Network::EdgeIterator>> currentArcs_;
+
+    bool isSplayRoot(int node) const
+    {
+        int parent(nodes_.at(node).parent);
+        return parent == Network::NONE || (nodes_.at(parent).left != node && nodes_.at(parent).right != node);
+    }
+
+    void addToSubtree(int node, long long delta)
+    {
+        if (node == Network::NONE)
+            return;
+        nodes_.at(node).value += delta;
+        nodes_.at(node).minimum += delta;
+        nodes_.at(node).lazyAdd += delta;
+    }
+
+    void pushLazy(int node)
+    {
+        node_t& current = nodes_.at(node);
+        if (current.lazyAdd == 0)
+            return;
+        addToSubtree(current.left, current.lazyAdd);
+        addToSubtree(current.right, current.lazyAdd);
+        current.lazyAdd = 0;
+    }
+
+    void update(int node)
+    {
+        node_t& current = nodes_.at(node);
+        current.minimum = current.value;
+        if (current.left != Network::NONE)
+            current.minimum = std::min(current.minimum, nodes_.at(current.left).minimum);
+        if (current.right != Network::NONE)
+            current.minimum = std::min(current.minimum, nodes_.at(current.right).minimum);
+    }
+
+    void rotate(int node)
+    {
+        int parent(nodes_.at(node).parent);
+        int grandparent(nodes_.at(parent).parent);
+        if (!isSplayRoot(parent))
+            (nodes_.at(grandparent).left == parent ? nodes_.at(grandparent).left : nodes_.at(grandparent).right) = node;
+        nodes_.at(node).parent = grandparent;
+        if (nodes_.at(parent).left == node)
+        {
+            nodes_.at(parent).left = nodes_.at(node).right;
+            if (nodes_.at(node).right != Network::NONE)
+                nodes_.at(nodes_.at(node).right).parent = parent;
+            nodes_.at(node).right = parent;
+        }
+        else
+        {
+            nodes_.at(parent).right = nodes_.at(node).left;
+            if (nodes_.at(node).left != Network::NONE)
+                nodes_.at(nodes_.at(node).left).parent = parent;
+            nodes_.at(node).left = parent;
+        }
+        nodes_.at(parent).parent = node;
+        update(parent);
+        update(node);
+    }
+
+    void splay(int node)
+    {
+        splayPath_.assign(1, node);
+        for (int current(node); !isSplayRoot(current); current = nodes_.at(current).parent)
+            splayPath_.push_back(nodes_.at(current).parent);
+        for (auto pathNode = splayPath_.rbegin(); pathNode != splayPath_.rend(); ++pathNode)
+            pushLazy(*pathNode);
+        while (!isSplayRoot(node))
+        {
+            int parent(nodes_.at(node).parent);
+            if (!isSplayRoot(parent))
+            {
+                int grandparent(nodes_.at(parent).parent);
+                bool isZigZig((nodes_.at(grandparent).left == parent) == (nodes_.at(parent).left == node));
+                rotate(isZigZig ? parent : node);
+            }
+            rotate(node);
+        }
+    }
+
+    // makes the path from the tree root to node preferred, node ends up as the splay root without right child
+    void access(int node)
+    {
+        int last(Network::NONE);
+        for (int current(node); current != Network::NONE; current = nodes_.at(current).parent)
+        {
+            splay(current);
+            nodes_.at(current).right = last;
+            update(current);
+            last = current;
+        }
+        splay(node);
+    }
+
+    int findRoot(int node)
+    {
+        access(node);
+        int root(node);
+        for (pushLazy(root); nodes_.at(root).left != Network::NONE; pushLazy(root))
+            root = nodes_.at(root).left;
+        splay(root);
+        return root;
+    }
+
+    // the node closest to the root among those with the minimal value on the path from node
+    int findMinimum(int node)
+    {
+        access(node);
+        long long minimum(nodes_.at(node).minimum);
+        int current(node);
+        while (true)
+        {
+            pushLazy(current);
+            int left(nodes_.at(current).left);
+            if (left != Network::NONE && nodes_.at(left).minimum == minimum)
+                current = left;
+            else if (nodes_.at(current).value == minimum)
+                break;
+            else
+                current = nodes_.at(current).right;
+        }
+        splay(current);
+        return current;
+    }
+
+    void link(int vertex, int edgeId)
+    {
+        const Network::edge_t& edge = network_.edge(edgeId);
+        access(vertex);
+        nodes_.at(vertex).value = usableCapacity(edge);
+        update(vertex);
+        nodes_.at(vertex).parent = edge.finishVertex();
+        parentEdge_.at(vertex) = edgeId;
+        linkedCapacity_.at(vertex) = usableCapacity(edge);
+    }
+
+    // detaches vertex from its parent and stores the flow pushed through their edge
+    void cut(int vertex)
+    {
+        access(vertex);
+        int flow(linkedCapacity_.at(vertex) - static_cast<int>(nodes_.at(vertex).value));
+        FLOW_STAT(if (flow > 0) stats_.countPush(flow == linkedCapacity_.at(vertex)));
+        network_.pushFlow(parentEdge_.at(vertex), flow);
+        parentEdge_.at(vertex) = Network::NONE;
+        if (nodes_.at(vertex).left != Network::NONE)
+            nodes_.at(nodes_.at(vertex).left).parent = Network::NONE;
+        nodes_.at(vertex).left = Network::NONE;
+        nodes_.at(vertex).value = INF_VALUE;
+        update(vertex);
+    }
+
+    bool buildLevels()
+    {
+        FLOW_STAT(SolverStats::PhaseTimer timer(stats_.levelGraphTime));
+        FLOW_STAT(++stats_.bfsRuns);
+        bfs_.clear();
+        bfs_.search(network_.source(), 0, ParallelBfs::Direction::FromRoot,
+                [this](int edgeId) { return usableCapacity(network_.edge(edgeId)) > 0; });
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            level_.at(vertex) = bfs_.distance(vertex);
+        return level_.at(network_.sink()) != Network::NONE;
+    }
+
+    bool isAdmissible(const Network::edge_t& edge) const
+    {
+        return usableCapacity(edge) > 0 && level_.at(edge.startVertex()) != Network::NONE
+                && level_.at(edge.finishVertex()) == level_.at(edge.startVertex()) + 1;
+    }
+
+    void blockingFlow()
+    {
+        FLOW_STAT(SolverStats::PhaseTimer timer(stats_.blockingFlowTime));
+        int source(network_.source()), sink(network_.sink());
+        nodes_.assign(size_, node_t());
+        parentEdge_.assign(size_, Network::NONE);
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            currentArcs_.at(vertex) = network_.vertexEdgeList(vertex);
+        while (!isCancelled())
+        {
+            int vertex(findRoot(source));
+            if (vertex == sink)
+            {
+                access(source);
+                int flow(static_cast<int>(nodes_.at(source).minimum));
+                addToSubtree(source, -flow);
+                result_ += flow;
+                for (int saturated(findMinimum(source)); nodes_.at(saturated).value == 0; saturated = findMinimum(source))
+                    cut(saturated);
+                continue;
+            }
+            auto& edges = currentArcs_.at(vertex);
+            while (!edges.empty() && !isAdmissible(*edges.begin()))
+                edges.popLastEdge();
+            if (!edges.empty())
+            {
+                link(vertex, edges.begin().getEdgeId());
+                continue;
+            }
+            if (vertex == source)
+                break;
+            level_.at(vertex) = Network::NONE;
+            auto backEdges = network_.vertexBackEdgeList(vertex);
+            for (auto edge = backEdges.begin(); edge != backEdges.end(); ++edge)
+                if (parentEdge_.at(edge->startVertex()) == edge.getEdgeId())
+                    cut(edge->startVertex());
+        }
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            if (parentEdge_.at(vertex) != Network::NONE)
+                cut(vertex);
+    }
+
+    void prepare() final
+    {
+        level_.resize(size_);
+        linkedCapacity_.resize(size_);
+        currentArcs_.resize(size_);
+        bfs_.attach(network_);
+    }
+
+    bool runPhases() final
+    {
+        while (buildLevels())
+        {
+            FLOW_STAT(++stats_.phases);
+            blockingFlow();
+            if (isCancelled())
+                return false;
+        }
+        return true;
+    }
+};
+
+/*
+ * Boykov-Kolmogorov: a source tree and a sink tree grow in the residual network until an edge joins them,
+ * the path through that edge is augmented and the vertices cut off by saturated tree edges are adopted
+ * by other vertices of their tree instead of rebuilding the trees from scratch. No polynomial bound,
+ * but on grid-like segmentation networks the trees stay valid for many augmentations.
+ * Tree parents, the active queue and the orphans are flat arrays, the adjacency is a CSR copy of edge ids.
+ */
+class BoykovKolmogorov : public FlowFindingAlgorithm
+{
+private:
+    constexpr static int TERMINAL = -2;
+    constexpr static int ORPHAN = -3;
+
+    enum class Tree : char { Free, Source, Sink };
+
+    std::vector<int> firstArc_, arcs_;
+    std::vector<Tree> tree_;
+    // edge to the parent, parent -> vertex in the source tree and vertex -> parent in the sink tree
+    std::vector<int> parentEdge_;
+    // distance to the tree root, exact when the timestamp equals time_
+    std::vector<int> distance_, timestamp_;
+    int time_ = 0;
+    // ring buffer of active vertices, every vertex is queued at most once
+    std::vector<int> activeQueue_;
+    std::vector<char> isActive_;
+    size_t activeHead_ = 0, activeCount_ = 0;
+    std::vector<int> orphans_;
+
+    void activate(int vertex)
+    {
+        if (isActive_.at(vertex))
+            return;
+        isActive_.at(vertex) = true;
+        activeQueue_.at((activeHead_ + activeCount_++) % size_) = vertex;
+    }
+
+    // the vertex that found a path stays first, it usually has more edges to the other tree
+    void activateFirst(int vertex)
+    {
+        isActive_.at(vertex) = true;
+        activeHead_ = (activeHead_ + size_ - 1) % size_;
+        activeQueue_.at(activeHead_) = vertex;
+        ++activeCount_;
+    }
+
+    int nextActive()
+    {
+        int vertex(activeQueue_.at(activeHead_));
+        activeHead_ = (activeHead_ + 1) % size_;
+        --activeCount_;
+        isActive_.at(vertex) = false;
+        return vertex;
+    }
+
+    int parentVertex(int vertex) const
+    {
+        const Network::edge_t& edge = network_.edge(parentEdge_.at(vertex));
+        return tree_.at(vertex) == Tree::Source ? edge.startVertex() : edge.finishVertex();
+    }
+
+    // residual edge of the arc that tree uses to hang the neighbour under vertex, or vertex under it if towardsVertex
+    static int treeEdge(Tree tree, int edgeId, bool towardsVertex)
+    {
+        return (tree == Tree::Source) == towardsVertex ? edgeId ^ 1 : edgeId;
+    }
+
+    void makeOrphan(int vertex)
+    {
+        parentEdge_.at(vertex) = ORPHAN;
+        orphans_.push_back(vertex);
+    }
+
+    void prepare()
+    {
+        firstArc_.assign(size_ + 1, 0);
+        for (const auto& edge : network_)
+            ++firstArc_.at(edge.startVertex());
+        std::partial_sum(firstArc_.begin(), firstArc_.end(), firstArc_.begin());
+        arcs_.resize(network_.edgesCount());
+        for (int edgeId(static_cast<int>(network_.edgesCount()) - 1); edgeId >= 0; --edgeId)
+            arcs_.at(--firstArc_.at(network_.edge(edgeId).startVertex())) = edgeId;
+
+        tree_.assign(size_, Tree::Free);
+        parentEdge_.assign(size_, Network::NONE);
+        distance_.assign(size_, 0);
+        timestamp_.assign(size_, 0);
+        time_ = 0;
+        activeQueue_.resize(size_);
+        isActive_.assign(size_, false);
+        activeHead_ = activeCount_ = 0;
+        orphans_.clear();
+
+        for (int terminal : {network_.source(), network_.sink()})
+        {
+            tree_.at(terminal) = terminal == network_.source() ? Tree::Source : Tree::Sink;
+            parentEdge_.at(terminal) = TERMINAL;
+            activate(terminal);
+        }
+    }
+
+    // grows the trees until an edge from the source tree to the sink tree appears, returns its id or NONE
+    int grow()
+    {
+        while (activeCount_ > 0)
+        {
+            int vertex(nextActive());
+            Tree tree(tree_.at(vertex));
+            if (tree == Tree::Free)
+                continue;
+            for (int arc(firstArc_.at(vertex)); arc < firstArc_.at(vertex + 1); ++arc)
+            {
+                int edgeId(treeEdge(tree, arcs_.at(arc), false));
+                if (network_.edge(edgeId).residualCapacity() == 0)
+                    continue;
+                int neighbour(network_.edge(arcs_.at(arc)).finishVertex());
+                if (tree_.at(neighbour) == Tree::Free)
+                {
+                    tree_.at(neighbour) = tree;
+                    parentEdge_.at(neighbour) = edgeId;
+                    distance_.at(neighbour) = distance_.at(vertex) + 1;
+                    timestamp_.at(neighbour) = timestamp_.at(vertex);
+                    activate(neighbour);
+                }
+                else if (tree_.at(neighbour) != tree)
+                {
+                    activateFirst(vertex);
+                    return edgeId;
+                }
+                else if (timestamp_.at(neighbour) <= timestamp_.at(vertex)
+                        && distance_.at(neighbour) > distance_.at(vertex) + 1)
+                {
+                    parentEdge_.at(neighbour) = edgeId;
+                    distance_.at(neighbour) = distance_.at(vertex) + 1;
+                    timestamp_.at(neighbour) = timestamp_.at(vertex);
+                }
+            }
+        }
+        return Network::NONE;
+    }
+
+    void augment(int joiningEdge)
+    {
+        const Network::edge_t& edge = network_.edge(joiningEdge);
+        int flow(edge.residualCapacity());
+        for (int vertex : {edge.startVertex(), edge.finishVertex()})
+            for (; parentEdge_.at(vertex) != TERMINAL; vertex = parentVertex(vertex))
+                flow = std::min(flow, network_.edge(parentEdge_.at(vertex)).residualCapacity());
+
+        network_.pushFlow(joiningEdge, flow);
+        for (int vertex : {edge.startVertex(), edge.finishVertex()})
+            while (parentEdge_.at(vertex) != TERMINAL)
+            {
+                int edgeId(parentEdge_.at(vertex)), parent(parentVertex(vertex));
+                network_.pushFlow(edgeId, flow);
+                FLOW_STAT(stats_.countPush(network_.edge(edgeId).residualCapacity() == 0));
+                if (network_.edge(edgeId).residualCapacity() == 0)
+                    makeOrphan(vertex);
+                vertex = parent;
+            }
+        result_ += flow;
+    }
+
+    // distance from vertex to the root of its tree, NONE if the parents lead to an orphan
+    int rootDistance(int vertex)
+    {
+        int distance(0), current(vertex);
+        while (timestamp_.at(current) != time_)
+        {
+            if (parentEdge_.at(current) == TERMINAL)
+            {
+                timestamp_.at(current) = time_;
+                distance_.at(current) = 0;
+                break;
+            }
+            if (parentEdge_.at(current) == ORPHAN)
+                return Network::NONE;
+            ++distance;
+            current = parentVertex(current);
+        }
+        distance += distance_.at(current);
+        int pathDistance(distance);
+        for (current = vertex; timestamp_.at(current) != time_; current = parentVertex(current))
+        {
+            timestamp_.at(current) = time_;
+            distance_.at(current) = pathDistance--;
+        }
+        return distance;
+    }
+
+    void adopt(int vertex)
+    {
+        Tree tree(tree_.at(vertex));
+        int bestEdge(Network::NONE), bestDistance(0);
+        for (int arc(firstArc_.at(vertex)); arc < firstArc_.at(vertex + 1); ++arc)
+        {
+            int neighbour(network_.edge(arcs_.at(arc)).finishVertex());
+            int edgeId(treeEdge(tree, arcs_.at(arc), true));
+            if (tree_.at(neighbour) != tree || network_.edge(edgeId).residualCapacity() == 0)
+                continue;
+            int distance(rootDistance(neighbour));
+            if (distance != Network::NONE && (bestEdge == Network::NONE || distance < bestDistance))
+            {
+                bestEdge = edgeId;
+                bestDistance = distance;
+            }
+        }
+        if (bestEdge != Network::NONE)
+        {
+            parentEdge_.at(vertex) = bestEdge;
+            distance_.at(vertex) = bestDistance + 1;
+            timestamp_.at(vertex) = time_;
+            return;
+        }
+
+        for (int arc(firstArc_.at(vertex)); arc < firstArc_.at(vertex + 1); ++arc)
+        {
+            int neighbour(network_.edge(arcs_.at(arc)).finishVertex());
+            if (tree_.at(neighbour) != tree)
+                continue;
+            if (network_.edge(treeEdge(tree, arcs_.at(arc), true)).residualCapacity() > 0)
+                activate(neighbour);
+            if (parentEdge_.at(neighbour) == treeEdge(tree, arcs_.at(arc), false))
+                makeOrphan(neighbour);
+        }
+        tree_.at(vertex) = Tree::Free;
+        parentEdge_.at(vertex) = Network::NONE;
+    }
+
+    void adoptOrphans()
+    {
+        ++time_;
+        for (size_t head(0); head < orphans_.size(); ++head)
+            adopt(orphans_.at(head));
+        orphans_.clear();
+    }
+public:
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
+        result_ = flowValue();
+        prepare();
+        while (!isCancelled())
+        {
+            int joiningEdge(grow());
+            if (joiningEdge == Network::NONE)
+                return true;
+            FLOW_STAT(++stats_.phases);
+            augment(joiningEdge);
+            adoptOrphans();
+        }
+        return false;
+    }
+};
+
+class PreflowPushAlgorithm : public FlowFindingAlgorithm
+{
+private:
+    std::vector<int> height_, overage_;
+    std::vector<Network::view_t<Network::EdgeIterator>> edgeLists_;
+    bool cutOnly_ = false;
+    bool keepHeights_ = false;
+
+    // exact distances to the sink in the residual network, size_ for the vertices that can't reach it
+    void initializeHeights()
+    {
+        height_.resize(size_);
+        bfs_.attach(network_);
+        bfs_.clear();
+        FLOW_STAT(++stats_.bfsRuns);
+        bfs_.search(network_.sink(), 0, ParallelBfs::Direction::ToRoot, [this](int edgeId)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            return edge.residualCapacity() > 0 && edge.startVertex() != network_.source();
+        });
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            height_.at(vertex) = bfs_.distance(vertex) == Network::NONE ? size_ : bfs_.distance(vertex);
+        height_.at(network_.source()) = size_;
+    }
+
+    // in cut-only mode vertices lifted to size_ can't reach the sink anymore and are left with their excess
+    bool isDischargeable(int vertex) const { return !cutOnly_ || height_.at(vertex) < static_cast<int>(size_); }
     
     void pushFlowImpl(Network::EdgeIterator edge, int flow)
     {
@@ -468,12 +1720,13 @@ private:
 
     void prepare()
     {
-        height_.resize(size_);
-        height_.assign(size_, 0);
-        height_.at(network_.source()) = size_;
+        if (!keepHeights_ || height_.size() != size_)
+            initializeHeights();
 
         overage_.resize(size_);
         overage_.assign(size_, 0);
+        for (const auto& edge : network_)
+            overage_.at(edge.startVertex()) -= edge.flow();
 
         for (
                 auto edge = network_.vertexEdgeList(network_.source()).begin();
@@ -481,7 +1734,7 @@ private:
                 ++edge
         )
         {
-            pushFlowImpl(edge, edge->capacity());
+            pushFlowImpl(edge, edge->residualCapacity());
         }
 
         edgeLists_.clear();
@@ -493,6 +1746,7 @@ private:
     void push(Network::EdgeIterator edge)
     {
         int flow(std::min(overage_.at(edge->startVertex()), edge->residualCapacity()));
+        FLOW_STAT(stats_.countPush(flow == edge->residualCapacity()));
         pushFlowImpl(edge, flow);
     }
 
@@ -503,13 +1757,15 @@ private:
             if (edge.residualCapacity() > 0)
                 newHeight = std::min(newHeight, height_.at(edge.finishVertex()));
         height_.at(vertex) = newHeight + 1;
+        FLOW_STAT(++stats_.relabels);
     }
 
     bool discharge(int vertex)
     {
-        if (overage_.at(vertex) <= 0)
+        if (overage_.at(vertex) <= 0 || !isDischargeable(vertex))
             return false;
-        while (overage_.at(vertex) > 0)
+        FLOW_STAT(++stats_.discharges);
+        while (overage_.at(vertex) > 0 && isDischargeable(vertex))
         {
             auto& edges = edgeLists_.at(vertex);
             if (edges.empty())
@@ -529,84 +1785,2834 @@ private:
         return true;
     }
 public:
+    /*
+     * Stop after the first phase: the network keeps a maximum preflow, result() is the max-flow value
+     * and minCut() is already valid, but excesses are not returned to the source.
+     */
+    void setCutOnly(bool cutOnly) { cutOnly_ = cutOnly; }
+
+    /*
+     * resume() continues with the heights of the previous run instead of zeroes. They stay valid
+     * if since then only source edges grew and sink edges shrank (flow above the new capacity cut off).
+     */
+    void setKeepHeights(bool keepHeights) { keepHeights_ = keepHeights; }
+
     bool run() final
     {
         if (!checkNetwork())
             return false;
         reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
         prepare();
+        FLOW_STAT(SolverStats::PhaseTimer timer(stats_.dischargeTime));
         bool canDoPushOrRelabel;
         do
         {
+            FLOW_STAT(++stats_.phases);
             canDoPushOrRelabel = false;
             for (int vertex(0); vertex < size_; ++vertex)
+            {
+                if (isCancelled())
+                    return false;
                 if (vertex != network_.source() && vertex != network_.sink())
                     canDoPushOrRelabel |= discharge(vertex);
+            }
         } while (canDoPushOrRelabel);
         result_ = overage_.at(network_.sink());
         return true;
     }
 };
 
-struct InputData
+/*
+ * Asynchronous lock-free push-relabel (Hong & He): every thread discharges its own active vertices,
+ * pushing to the lowest residual neighbour, with excesses and residual capacities kept in atomics.
+ * Active vertices live in per-thread deques, idle threads steal from the others.
+ * Global relabels are done between rounds by a level-synchronous BFS split among threads.
+ */
+class ParallelPreflowPushAlgorithm : public FlowFindingAlgorithm
 {
-    size_t N;
-    std::vector<int> costs;
-    std::vector<std::vector<int>> depends;
-    static InputData read(std::istream& in)
+private:
+    struct WorkQueue
     {
-        size_t N;
-        in >> N;
-        std::vector<int> costs(N + 1);
-        for (size_t theme(1); theme <= N; ++theme)
-            in >> costs.at(theme);
-        std::vector<std::vector<int>> depends(1);
-        depends.reserve(N + 1);
-        for (size_t theme(1); theme <= N; ++theme)
+        std::mutex mutex;
+        std::deque<int> vertices;
+    };
+
+    size_t threadsCount_;
+
+    std::vector<int> edgeListsStart_, edgeListsItems_, edgeHeads_;
+    std::vector<std::atomic<int>> residual_, overage_, height_;
+    std::vector<std::atomic<bool>> isActive_;
+    std::vector<WorkQueue> queues_;
+
+    std::atomic<int> activeCount_{0};
+    std::mutex statsMutex_;
+    std::atomic<int> relabelsCount_{0};
+    std::atomic<bool> globalRelabelRequested_{false};
+
+    bool isTerminal(int vertex) const { return vertex == network_.source() || vertex == network_.sink(); }
+
+    void prepare()
+    {
+        edgeListsStart_.assign(size_ + 1, 0);
+        edgeListsItems_.clear();
+        edgeListsItems_.reserve(network_.edgesCount());
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
         {
-            size_t sizeOfDepends;
-            in >> sizeOfDepends;
-            depends.push_back(std::vector<int>(sizeOfDepends));
-            for (int& dependingTheme : depends.back())
-                in >> dependingTheme;
+            for (auto edge = network_.vertexEdgeList(vertex).begin(); edge; ++edge)
+                edgeListsItems_.push_back(edge.getEdgeId());
+            edgeListsStart_.at(vertex + 1) = static_cast<int>(edgeListsItems_.size());
         }
-        return {N, costs, depends};
+
+        edgeHeads_.resize(network_.edgesCount());
+        residual_ = std::vector<std::atomic<int>>(network_.edgesCount());
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); ++edgeId)
+        {
+            edgeHeads_.at(edgeId) = network_.edge(edgeId).finishVertex();
+            residual_.at(edgeId).store(network_.edge(edgeId).residualCapacity(), std::memory_order_relaxed);
+        }
+
+        overage_ = std::vector<std::atomic<int>>(size_);
+        height_ = std::vector<std::atomic<int>>(size_);
+        isActive_ = std::vector<std::atomic<bool>>(size_);
+        queues_ = std::vector<WorkQueue>(threadsCount_);
+        activeCount_ = 0;
+        relabelsCount_ = 0;
+        globalRelabelRequested_ = false;
+        bfs_.attach(network_);
+
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+        {
+            overage_.at(vertex).store(0, std::memory_order_relaxed);
+            isActive_.at(vertex).store(false, std::memory_order_relaxed);
+        }
+        for (const auto& edge : network_)
+            overage_.at(edge.startVertex()).fetch_sub(edge.flow(), std::memory_order_relaxed);
+        int source(network_.source());
+        for (int index(edgeListsStart_.at(source)); index < edgeListsStart_.at(source + 1); ++index)
+        {
+            int edgeId(edgeListsItems_.at(index));
+            int flow(residual_.at(edgeId).load(std::memory_order_relaxed));
+            residual_.at(edgeId) -= flow;
+            residual_.at(edgeId ^ 1) += flow;
+            overage_.at(source) -= flow;
+            overage_.at(edgeHeads_.at(edgeId)) += flow;
+        }
+
+        globalRelabel();
+
+        size_t nextQueue(0);
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            if (!isTerminal(vertex) && overage_.at(vertex).load(std::memory_order_relaxed) > 0)
+            {
+                isActive_.at(vertex).store(true, std::memory_order_relaxed);
+                ++activeCount_;
+                queues_.at(nextQueue++ % threadsCount_).vertices.push_back(vertex);
+            }
     }
-};
 
-template <typename Algorithm>
-int solution(const InputData& input)
-{
-    Network graph(input.N + 2, 0, input.N + 1);
-    int costsSum(0);
-    for (int theme(1); theme <= input.N; ++theme)
+    void globalRelabel()
     {
-        if (input.costs.at(theme) > 0)
+        FLOW_STAT(SolverStats::PhaseTimer timer(stats_.globalRelabelTime));
+        FLOW_STAT(++stats_.globalRelabels);
+        FLOW_STAT(stats_.bfsRuns += 2);
+        // height is the distance to the sink, vertices cut off from it get size_ + distance to the source
+        bfs_.clear();
+        bfs_.search(network_.sink(), 0, ParallelBfs::Direction::ToRoot, [this](int edgeId)
         {
-            costsSum += input.costs.at(theme);
-            graph.insertEdge(graph.source(), theme, input.costs.at(theme));
-        } else if (input.costs.at(theme) < 0) graph.insertEdge(theme, graph.sink(), -input.costs.at(theme));
-        for (int depend : input.depends.at(theme))
-            graph.insertEdge(theme, depend, Network::INF);
+            return residual_.at(edgeId).load(std::memory_order_relaxed) > 0 && edgeHeads_.at(edgeId ^ 1) != network_.source();
+        });
+        bfs_.search(network_.source(), static_cast<int>(size_), ParallelBfs::Direction::ToRoot,
+                [this](int edgeId) { return residual_.at(edgeId).load(std::memory_order_relaxed) > 0; });
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            height_.at(vertex).store(bfs_.distance(vertex) == Network::NONE ? 2 * static_cast<int>(size_) : bfs_.distance(vertex),
+                    std::memory_order_relaxed);
+        relabelsCount_ = 0;
+        globalRelabelRequested_ = false;
     }
-    std::unique_ptr<FlowFindingAlgorithm> algorithm = std::make_unique<Algorithm>();
-    algorithm->loadNetwork(std::move(graph));
-    algorithm->reset();
-    algorithm->run();
-    algorithm->storeNetwork(graph);
-    return costsSum - algorithm->result();
-}
 
-void run()
+    void activate(int vertex, size_t threadId)
+    {
+        if (isTerminal(vertex) || isActive_.at(vertex).exchange(true))
+            return;
+        ++activeCount_;
+        std::lock_guard<std::mutex> lock(queues_.at(threadId).mutex);
+        queues_.at(threadId).vertices.push_back(vertex);
+    }
+
+    int popVertex(size_t threadId)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queues_.at(threadId).mutex);
+            auto& vertices = queues_.at(threadId).vertices;
+            if (!vertices.empty())
+            {
+                int vertex(vertices.back());
+                vertices.pop_back();
+                return vertex;
+            }
+        }
+        for (size_t shift(1); shift < threadsCount_; ++shift)
+        {
+            auto& victim = queues_.at((threadId + shift) % threadsCount_);
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.vertices.empty())
+            {
+                int vertex(victim.vertices.front());
+                victim.vertices.pop_front();
+                return vertex;
+            }
+        }
+        return Network::NONE;
+    }
+
+    void discharge(int vertex, size_t threadId, [[maybe_unused]] SolverStats& stats)
+    {
+        FLOW_STAT(++stats.discharges);
+        while (overage_.at(vertex).load() > 0)
+        {
+            int lowestEdge(Network::NONE);
+            int lowestHeight(0);
+            for (int index(edgeListsStart_.at(vertex)); index < edgeListsStart_.at(vertex + 1); ++index)
+            {
+                int edgeId(edgeListsItems_.at(index));
+                if (residual_.at(edgeId).load() <= 0)
+                    continue;
+                int nextHeight(height_.at(edgeHeads_.at(edgeId)).load());
+                if (lowestEdge == Network::NONE || nextHeight < lowestHeight)
+                {
+                    lowestEdge = edgeId;
+                    lowestHeight = nextHeight;
+                }
+            }
+            if (lowestEdge == Network::NONE)
+                break;
+            if (height_.at(vertex).load() > lowestHeight)
+            {
+                int residual(residual_.at(lowestEdge).load());
+                int flow(std::min(overage_.at(vertex).load(), residual));
+                residual_.at(lowestEdge) -= flow;
+                residual_.at(lowestEdge ^ 1) += flow;
+                overage_.at(vertex) -= flow;
+                overage_.at(edgeHeads_.at(lowestEdge)) += flow;
+                activate(edgeHeads_.at(lowestEdge), threadId);
+                FLOW_STAT(stats.countPush(flow == residual));
+            }
+            else
+            {
+                height_.at(vertex).store(lowestHeight + 1);
+                FLOW_STAT(++stats.relabels);
+                if (++relabelsCount_ >= static_cast<int>(size_ + network_.edgesCount()))
+                    globalRelabelRequested_ = true;
+            }
+        }
+        isActive_.at(vertex).store(false);
+        if (overage_.at(vertex).load() > 0 && !isActive_.at(vertex).exchange(true))
+        {
+            std::lock_guard<std::mutex> lock(queues_.at(threadId).mutex);
+            queues_.at(threadId).vertices.push_back(vertex);
+        }
+        else
+            --activeCount_;
+    }
+
+    void work(size_t threadId)
+    {
+        SolverStats stats;
+        while (!globalRelabelRequested_.load() && !isCancelled())
+        {
+            int vertex(popVertex(threadId));
+            if (vertex != Network::NONE)
+                discharge(vertex, threadId, stats);
+            else if (activeCount_.load() == 0)
+                break;
+            else
+                std::this_thread::yield();
+        }
+        FLOW_STAT(std::lock_guard<std::mutex> lock(statsMutex_));
+        FLOW_STAT(stats_ += stats);
+    }
+
+    void storeFlow()
+    {
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); ++edgeId)
+        {
+            Network::edge_t& edge = network_.edge(edgeId);
+            edge.flow() = edge.capacity() - residual_.at(edgeId).load(std::memory_order_relaxed);
+        }
+    }
+public:
+    explicit ParallelPreflowPushAlgorithm(size_t threadsCount = std::thread::hardware_concurrency())
+        : threadsCount_(std::max<size_t>(threadsCount, 1))
+    {
+        bfs_.setThreadsCount(threadsCount_);
+    }
+
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
+        prepare();
+        while (activeCount_.load() > 0)
+        {
+            FLOW_STAT(++stats_.phases);
+            {
+                FLOW_STAT(SolverStats::PhaseTimer timer(stats_.dischargeTime));
+                std::vector<std::thread> threads;
+                for (size_t threadId(1); threadId < threadsCount_; ++threadId)
+                    threads.emplace_back(&ParallelPreflowPushAlgorithm::work, this, threadId);
+                work(0);
+                for (auto& thread : threads)
+                    thread.join();
+            }
+            if (isCancelled())
+                return false;
+            if (globalRelabelRequested_.load())
+                globalRelabel();
+        }
+        storeFlow();
+        result_ = overage_.at(network_.sink()).load();
+        return true;
+    }
+};
+
+/*
+ * Races copies of the network through several algorithms on separate threads.
+ * The first one to finish with a flow that passes verifyFlow() wins, the rest are stopped
+ * through a shared cancel flag.
+ */
+class PortfolioAlgorithm : public FlowFindingAlgorithm
+{
+public:
+    using factory_t = std::function<std::unique_ptr<FlowFindingAlgorithm>()>;
+private:
+    std::vector<factory_t> factories_;
+    int winner_ = Network::NONE;
+public:
+    PortfolioAlgorithm()
+        : factories_({
+                []() { return std::make_unique<MalhotraKumarMaheshwari>(); },
+                []() { return std::make_unique<PreflowPushAlgorithm>(); }
+        })
+    {}
+
+    explicit PortfolioAlgorithm(std::vector<factory_t> factories)
+        : factories_(std::move(factories))
+    {}
+
+    // index of the factory whose algorithm produced the stored flow
+    int winner() const { return winner_; }
+
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        winner_ = Network::NONE;
+        std::atomic<bool> cancelled(false);
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t finishedCount(0);
+
+        std::vector<std::unique_ptr<FlowFindingAlgorithm>> solvers;
+        for (const auto& factory : factories_)
+        {
+            solvers.push_back(factory());
+            solvers.back()->loadNetwork(Network(network_));
+            solvers.back()->setCancelFlag(&cancelled);
+        }
+        std::vector<std::thread> threads;
+        for (int index(0); index < static_cast<int>(solvers.size()); ++index)
+            threads.emplace_back([&, index]()
+            {
+                bool isDone(solvers.at(index)->run() && solvers.at(index)->verifyFlow());
+                std::lock_guard<std::mutex> lock(mutex);
+                if (isDone && winner_ == Network::NONE)
+                {
+                    winner_ = index;
+                    cancelled = true;
+                }
+                ++finishedCount;
+                finished.notify_one();
+            });
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (winner_ == Network::NONE && finishedCount < solvers.size())
+                if (!finished.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+                        return winner_ != Network::NONE || finishedCount == solvers.size(); })
+                        && isCancelled())
+                    cancelled = true;
+        }
+        for (auto& thread : threads)
+            thread.join();
+        if (winner_ == Network::NONE)
+            return false;
+        solvers.at(winner_)->storeNetwork(network_);
+        result_ = solvers.at(winner_)->result();
+        stats_ = solvers.at(winner_)->stats();
+        return true;
+    }
+};
+
+enum class VertexOrder { Bfs, ReverseCuthillMcKee };
+
+/*
+ * Solves a renumbered copy of the network so that neighbouring vertices, and their edges,
+ * are close in memory, then writes the flow back: BFS order from the source,
+ * or reverse Cuthill-McKee (BFS from low-degree vertices taking neighbours by degree, reversed).
+ * Edges are copied pair by pair, so edge id ^ 1 still is the back edge in the copy.
+ */
+template <typename Algorithm>
+class ReorderedAlgorithm : public FlowFindingAlgorithm
+{
+private:
+    Algorithm algorithm_;
+    VertexOrder order_;
+    std::vector<int> newVertex_, newEdge_, degree_;
+    std::vector<int> neighbours_;
+
+    // appends to bfsQueue_ the vertices reachable from root that have no new number yet
+    void numberFrom(int root)
+    {
+        size_t head(bfsQueue_.size());
+        newVertex_.at(root) = static_cast<int>(bfsQueue_.size());
+        bfsQueue_.push_back(root);
+        for (; head < bfsQueue_.size(); ++head)
+        {
+            int vertex(bfsQueue_.at(head));
+            neighbours_.clear();
+            for (const Network::edge_t& edge : network_.vertexEdgeList(vertex))
+                if (newVertex_.at(edge.finishVertex()) == Network::NONE)
+                {
+                    newVertex_.at(edge.finishVertex()) = static_cast<int>(bfsQueue_.size() + neighbours_.size());
+                    neighbours_.push_back(edge.finishVertex());
+                }
+            if (order_ == VertexOrder::ReverseCuthillMcKee)
+            {
+                std::stable_sort(neighbours_.begin(), neighbours_.end(),
+                        [&](int first, int second) { return degree_.at(first) < degree_.at(second); });
+                for (size_t index(0); index < neighbours_.size(); ++index)
+                    newVertex_.at(neighbours_.at(index)) = static_cast<int>(bfsQueue_.size() + index);
+            }
+            bfsQueue_.insert(bfsQueue_.end(), neighbours_.begin(), neighbours_.end());
+        }
+    }
+
+    void computeOrder()
+    {
+        newVertex_.assign(size_, Network::NONE);
+        bfsQueue_.clear();
+        if (order_ == VertexOrder::Bfs)
+        {
+            numberFrom(network_.source());
+            for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+                if (newVertex_.at(vertex) == Network::NONE)
+                    numberFrom(vertex);
+            return;
+        }
+        degree_.assign(size_, 0);
+        for (const auto& edge : network_)
+            ++degree_.at(edge.startVertex());
+        std::vector<int> byDegree(size_);
+        std::iota(byDegree.begin(), byDegree.end(), 0);
+        std::stable_sort(byDegree.begin(), byDegree.end(),
+                [&](int first, int second) { return degree_.at(first) < degree_.at(second); });
+        for (int vertex : byDegree)
+            if (newVertex_.at(vertex) == Network::NONE)
+                numberFrom(vertex);
+        for (int& number : newVertex_)
+            number = static_cast<int>(size_) - 1 - number;
+    }
+
+    // the renumbered copy with the current flow, edge pairs are taken in the order of their new start vertex
+    Network renumber()
+    {
+        computeOrder();
+        std::vector<int> oldVertex(size_);
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            oldVertex.at(newVertex_.at(vertex)) = vertex;
+        Network reordered(size_, newVertex_.at(network_.source()), newVertex_.at(network_.sink()));
+        reordered.reserveEdges(network_.edgesCount());
+        newEdge_.assign(network_.edgesCount(), Network::NONE);
+        for (int vertex : oldVertex)
+        {
+            auto edges = network_.vertexEdgeList(vertex);
+            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+            {
+                int edgeId(edge.getEdgeId() & ~1);
+                if (newEdge_.at(edgeId) != Network::NONE)
+                    continue;
+                const Network::edge_t& forward = network_.edge(edgeId);
+                const Network::edge_t& backward = network_.edge(edgeId ^ 1);
+                newEdge_.at(edgeId) = reordered.insertEdgePair(newVertex_.at(forward.startVertex()),
+                        newVertex_.at(forward.finishVertex()), forward.capacity(), backward.capacity(), forward.cost());
+                reordered.pushFlow(newEdge_.at(edgeId), forward.flow());
+            }
+        }
+        return reordered;
+    }
+
+    void storeFlow(const Network& reordered)
+    {
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); edgeId += 2)
+            network_.pushFlow(edgeId, reordered.edge(newEdge_.at(edgeId)).flow() - network_.edge(edgeId).flow());
+    }
+public:
+    explicit ReorderedAlgorithm(VertexOrder order = VertexOrder::Bfs)
+        : order_(order)
+    {}
+
+    // the wrapped solver, e.g. for its own options
+    Algorithm& algorithm() { return algorithm_; }
+
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
+        algorithm_.setCancelFlag(cancelFlag_);
+        algorithm_.loadNetwork(renumber());
+        bool isDone(algorithm_.resume());
+        Network reordered;
+        algorithm_.storeNetwork(reordered);
+        storeFlow(reordered);
+        result_ = algorithm_.result();
+        stats_ = algorithm_.stats();
+        return isDone;
+    }
+};
+
+/*
+ * Recognizes unit-capacity bipartite networks (source -> left -> right -> sink, every edge directed
+ * with capacity 1, no other edges) and solves them as a matching by Hopcroft-Karp in O(E sqrt(V))
+ * on flat adjacency arrays. Other networks go to Algorithm. Either way the flow ends up in the network.
+ */
+template <typename Algorithm>
+class MatchingFastPath : public FlowFindingAlgorithm
+{
+private:
+    enum class Side : char { None, Left, Right };
+
+    Algorithm algorithm_;
+    bool isMatching_ = false;
+
+    std::vector<Side> side_;
+    std::vector<int> index_;
+    std::vector<int> sourceEdges_, sinkEdges_;
+    std::vector<int> adjacencyStart_, adjacencyRight_, adjacencyEdge_;
+    std::vector<int> matchedArc_, matchedLeft_, layer_, nextArc_;
+    std::vector<int> stack_;
+
+    bool isUnitEdge(int edgeId) const
+    {
+        const Network::edge_t& edge = network_.edge(edgeId);
+        return edge.capacity() == 1 && network_.edge(edgeId ^ 1).capacity() == 0 && edge.flow() >= 0;
+    }
+
+    bool markSide(int vertex, Side side, int edgeId, std::vector<int>& terminalEdges)
+    {
+        if (side_.at(vertex) != Side::None)
+            return false;
+        side_.at(vertex) = side;
+        index_.at(vertex) = static_cast<int>(terminalEdges.size());
+        terminalEdges.push_back(edgeId);
+        return true;
+    }
+
+    bool detect()
+    {
+        int source(network_.source()), sink(network_.sink());
+        side_.assign(size_, Side::None);
+        index_.assign(size_, Network::NONE);
+        sourceEdges_.clear();
+        sinkEdges_.clear();
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); edgeId += 2)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            if (!isUnitEdge(edgeId) || edge.startVertex() == sink || edge.finishVertex() == source
+                    || (edge.startVertex() == source && edge.finishVertex() == sink))
+                return false;
+            if (edge.startVertex() == source && !markSide(edge.finishVertex(), Side::Left, edgeId, sourceEdges_))
+                return false;
+            if (edge.finishVertex() == sink && !markSide(edge.startVertex(), Side::Right, edgeId, sinkEdges_))
+                return false;
+        }
+
+        adjacencyStart_.assign(sourceEdges_.size() + 1, 0);
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); edgeId += 2)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            if (edge.startVertex() == source || edge.finishVertex() == sink)
+                continue;
+            if (side_.at(edge.startVertex()) != Side::Left || side_.at(edge.finishVertex()) != Side::Right)
+                return false;
+            ++adjacencyStart_.at(index_.at(edge.startVertex()) + 1);
+        }
+        std::partial_sum(adjacencyStart_.begin(), adjacencyStart_.end(), adjacencyStart_.begin());
+        adjacencyRight_.resize(adjacencyStart_.back());
+        adjacencyEdge_.resize(adjacencyStart_.back());
+        nextArc_.assign(adjacencyStart_.begin(), adjacencyStart_.end() - 1);
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); edgeId += 2)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            if (edge.startVertex() == source || edge.finishVertex() == sink)
+                continue;
+            int arc(nextArc_.at(index_.at(edge.startVertex()))++);
+            adjacencyRight_.at(arc) = index_.at(edge.finishVertex());
+            adjacencyEdge_.at(arc) = edgeId;
+        }
+        return true;
+    }
+
+    // the stored flow as the starting matching
+    void initializeMatching()
+    {
+        matchedArc_.assign(sourceEdges_.size(), Network::NONE);
+        matchedLeft_.assign(sinkEdges_.size(), Network::NONE);
+        for (int left(0); left < static_cast<int>(sourceEdges_.size()); ++left)
+            for (int arc(adjacencyStart_.at(left)); arc < adjacencyStart_.at(left + 1); ++arc)
+                if (network_.edge(adjacencyEdge_.at(arc)).flow() > 0
+                        && matchedArc_.at(left) == Network::NONE && matchedLeft_.at(adjacencyRight_.at(arc)) == Network::NONE)
+                {
+                    matchedArc_.at(left) = arc;
+                    matchedLeft_.at(adjacencyRight_.at(arc)) = left;
+                }
+    }
+
+    // layers of left vertices by alternating BFS from the free ones, true if a free right vertex is reachable
+    bool buildLayers()
+    {
+        layer_.assign(sourceEdges_.size(), Network::NONE);
+        stack_.clear();
+        for (int left(0); left < static_cast<int>(sourceEdges_.size()); ++left)
+            if (matchedArc_.at(left) == Network::NONE)
+            {
+                layer_.at(left) = 0;
+                stack_.push_back(left);
+            }
+        bool isFound(false);
+        for (size_t head(0); head < stack_.size(); ++head)
+        {
+            int left(stack_.at(head));
+            for (int arc(adjacencyStart_.at(left)); arc < adjacencyStart_.at(left + 1); ++arc)
+            {
+                int nextLeft(matchedLeft_.at(adjacencyRight_.at(arc)));
+                if (nextLeft == Network::NONE)
+                    isFound = true;
+                else if (layer_.at(nextLeft) == Network::NONE)
+                {
+                    layer_.at(nextLeft) = layer_.at(left) + 1;
+                    stack_.push_back(nextLeft);
+                }
+            }
+        }
+        return isFound;
+    }
+
+    // iterative DFS along the layers, the stack holds the left vertices of the current alternating path
+    bool augmentFrom(int root)
+    {
+        stack_.assign(1, root);
+        while (!stack_.empty())
+        {
+            int left(stack_.back());
+            if (nextArc_.at(left) == adjacencyStart_.at(left + 1))
+            {
+                layer_.at(left) = Network::NONE;
+                stack_.pop_back();
+                if (!stack_.empty())
+                    ++nextArc_.at(stack_.back());
+                continue;
+            }
+            int nextLeft(matchedLeft_.at(adjacencyRight_.at(nextArc_.at(left))));
+            if (nextLeft == Network::NONE)
+            {
+                for (int pathLeft : stack_)
+                {
+                    matchedArc_.at(pathLeft) = nextArc_.at(pathLeft);
+                    matchedLeft_.at(adjacencyRight_.at(nextArc_.at(pathLeft))) = pathLeft;
+                }
+                return true;
+            }
+            if (layer_.at(nextLeft) == layer_.at(left) + 1)
+                stack_.push_back(nextLeft);
+            else
+                ++nextArc_.at(left);
+        }
+        return false;
+    }
+
+    void storeMatching()
+    {
+        network_.clear();
+        result_ = 0;
+        for (int left(0); left < static_cast<int>(sourceEdges_.size()); ++left)
+            if (matchedArc_.at(left) != Network::NONE)
+            {
+                network_.pushFlow(sourceEdges_.at(left), 1);
+                network_.pushFlow(adjacencyEdge_.at(matchedArc_.at(left)), 1);
+                network_.pushFlow(sinkEdges_.at(adjacencyRight_.at(matchedArc_.at(left))), 1);
+                ++result_;
+            }
+    }
+
+    bool hopcroftKarp()
+    {
+        initializeMatching();
+        while (buildLayers())
+        {
+            if (isCancelled())
+                return false;
+            FLOW_STAT(++stats_.phases);
+            FLOW_STAT(++stats_.bfsRuns);
+            nextArc_.assign(adjacencyStart_.begin(), adjacencyStart_.end() - 1);
+            for (int left(0); left < static_cast<int>(sourceEdges_.size()); ++left)
+                if (matchedArc_.at(left) == Network::NONE)
+                    augmentFrom(left);
+        }
+        storeMatching();
+        return true;
+    }
+
+    bool runAlgorithm()
+    {
+        algorithm_.setCancelFlag(cancelFlag_);
+        algorithm_.loadNetwork(std::move(network_));
+        bool isDone(algorithm_.resume());
+        algorithm_.storeNetwork(network_);
+        result_ = algorithm_.result();
+        stats_ = algorithm_.stats();
+        return isDone;
+    }
+public:
+    // whether the last run was solved as a matching
+    bool isMatching() const { return isMatching_; }
+
+    Algorithm& algorithm() { return algorithm_; }
+
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork())
+            return false;
+        isMatching_ = detect();
+        return isMatching_ ? hopcroftKarp() : runAlgorithm();
+    }
+};
+
+/*
+ * Maximum flow of the minimum total cost, edges get their costs from Network::insertCostEdge.
+ * result() is the flow value and cost() its cost.
+ */
+class MinCostFlowAlgorithm : public FlowFindingAlgorithm
+{
+protected:
+    constexpr static long long INF_DISTANCE = std::numeric_limits<long long>::max() / 4;
+
+    long long cost_ = 0;
+
+    long long flowCost()
+    {
+        long long cost(0);
+        for (const auto& edge : network_)
+            if (edge.flow() > 0)
+                cost += static_cast<long long>(edge.flow()) * edge.cost();
+        return cost;
+    }
+public:
+    long long cost() const { return cost_; }
+
+    int insertCostEdge(int startVertex, int finishVertex, int capacity, int cost)
+    {
+        return network_.insertCostEdge(startVertex, finishVertex, capacity, cost);
+    }
+};
+
+/*
+ * Successive shortest paths: augments along a cheapest residual path found by Dijkstra on costs
+ * reduced by vertex potentials. Negative costs are allowed, negative cycles are not.
+ */
+class SuccessiveShortestPaths : public MinCostFlowAlgorithm
+{
+private:
+    std::vector<long long> potential_, distance_;
+    std::vector<int> parentEdge_;
+
+    long long reducedCost(const Network::edge_t& edge) const
+    {
+        return edge.cost() + potential_.at(edge.startVertex()) - potential_.at(edge.finishVertex());
+    }
+
+    // Bellman-Ford on the residual network, false if it has a negative cycle
+    bool initializePotentials()
+    {
+        potential_.assign(size_, INF_DISTANCE);
+        std::vector<int> queuedCount(size_, 0);
+        std::vector<bool> isQueued(size_, false);
+        std::queue<int> bfsQueue({network_.source()});
+        potential_.at(network_.source()) = 0;
+        while (!bfsQueue.empty())
+        {
+            int vertex(bfsQueue.front());
+            bfsQueue.pop();
+            isQueued.at(vertex) = false;
+            for (const Network::edge_t& edge : network_.vertexEdgeList(vertex))
+                if (edge.residualCapacity() > 0 && potential_.at(vertex) + edge.cost() < potential_.at(edge.finishVertex()))
+                {
+                    potential_.at(edge.finishVertex()) = potential_.at(vertex) + edge.cost();
+                    if (!isQueued.at(edge.finishVertex()))
+                    {
+                        if (++queuedCount.at(edge.finishVertex()) > static_cast<int>(size_))
+                            return false;
+                        isQueued.at(edge.finishVertex()) = true;
+                        bfsQueue.push(edge.finishVertex());
+                    }
+                }
+        }
+        // the rest can't become reachable later: augmentations only add edges between reachable vertices
+        for (auto& potential : potential_)
+            if (potential == INF_DISTANCE)
+                potential = 0;
+        return true;
+    }
+
+    bool findShortestPath()
+    {
+        FLOW_STAT(++stats_.bfsRuns);
+        distance_.assign(size_, INF_DISTANCE);
+        parentEdge_.assign(size_, Network::NONE);
+        using entry_t = std::pair<long long, int>;
+        std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t>> heap;
+        distance_.at(network_.source()) = 0;
+        heap.push({0, network_.source()});
+        while (!heap.empty())
+        {
+            auto [distance, vertex] = heap.top();
+            heap.pop();
+            if (distance != distance_.at(vertex))
+                continue;
+            auto edges = network_.vertexEdgeList(vertex);
+            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+            {
+                long long newDistance(distance + reducedCost(*edge));
+                if (edge->residualCapacity() > 0 && newDistance < distance_.at(edge->finishVertex()))
+                {
+                    distance_.at(edge->finishVertex()) = newDistance;
+                    parentEdge_.at(edge->finishVertex()) = edge.getEdgeId();
+                    heap.push({newDistance, edge->finishVertex()});
+                }
+            }
+        }
+        long long sinkDistance(distance_.at(network_.sink()));
+        if (sinkDistance == INF_DISTANCE)
+            return false;
+        // capping at the sink distance keeps all residual reduced costs non-negative
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+            potential_.at(vertex) += std::min(distance_.at(vertex), sinkDistance);
+        return true;
+    }
+
+    int augment()
+    {
+        int flow(Network::INF);
+        for (int vertex(network_.sink()); vertex != network_.source(); vertex = network_.edge(parentEdge_.at(vertex)).startVertex())
+            flow = std::min(flow, network_.edge(parentEdge_.at(vertex)).residualCapacity());
+        for (int vertex(network_.sink()); vertex != network_.source(); vertex = network_.edge(parentEdge_.at(vertex)).startVertex())
+        {
+            FLOW_STAT(stats_.countPush(flow == network_.edge(parentEdge_.at(vertex)).residualCapacity()));
+            network_.pushFlow(parentEdge_.at(vertex), flow);
+        }
+        return flow;
+    }
+public:
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    // the stored flow must already be the cheapest one of its value
+    bool resume() final
+    {
+        if (!checkNetwork() || !initializePotentials())
+            return false;
+        result_ = flowValue();
+        while (findShortestPath())
+        {
+            if (isCancelled())
+                return false;
+            FLOW_STAT(++stats_.phases);
+            result_ += augment();
+        }
+        cost_ = flowCost();
+        return true;
+    }
+};
+
+/*
+ * Goldberg-Tarjan cost scaling for large instances: a maximum flow is found by push-relabel,
+ * then ε-optimal refinements with push-relabel on admissible (negative reduced cost) edges
+ * cancel its negative cycles. Costs are multiplied by n + 1, so refinement with ε = 1 ends optimal.
+ */
+class CostScalingAlgorithm : public MinCostFlowAlgorithm
+{
+private:
+    constexpr static long long SCALING_FACTOR = 8;
+
+    std::vector<long long> potential_;
+    std::vector<int> overage_;
+    std::vector<Network::view_t<Network::EdgeIterator>> edgeLists_;
+    std::queue<int> activeVertices_;
+    long long costScale_ = 1;
+
+    long long reducedCost(const Network::edge_t& edge) const
+    {
+        return edge.cost() * costScale_ + potential_.at(edge.startVertex()) - potential_.at(edge.finishVertex());
+    }
+
+    bool findMaximumFlow()
+    {
+        PreflowPushAlgorithm maximumFlow;
+        maximumFlow.setCancelFlag(cancelFlag_);
+        maximumFlow.loadNetwork(std::move(network_));
+        bool isDone(maximumFlow.resume());
+        maximumFlow.storeNetwork(network_);
+        result_ = maximumFlow.result();
+        stats_ += maximumFlow.stats();
+        return isDone;
+    }
+
+    void pushFlowImpl(Network::EdgeIterator edge, int flow)
+    {
+        edge.pushFlow(flow);
+        overage_.at(edge->startVertex()) -= flow;
+        if (overage_.at(edge->finishVertex()) <= 0 && overage_.at(edge->finishVertex()) + flow > 0)
+            activeVertices_.push(edge->finishVertex());
+        overage_.at(edge->finishVertex()) += flow;
+    }
+
+    void relabel(int vertex, long long epsilon)
+    {
+        long long newPotential(-INF_DISTANCE);
+        for (const auto& edge : network_.vertexEdgeList(vertex))
+            if (edge.residualCapacity() > 0)
+                newPotential = std::max(newPotential, potential_.at(edge.finishVertex()) - edge.cost() * costScale_);
+        potential_.at(vertex) = newPotential - epsilon;
+        FLOW_STAT(++stats_.relabels);
+    }
+
+    void discharge(int vertex, long long epsilon)
+    {
+        FLOW_STAT(++stats_.discharges);
+        while (overage_.at(vertex) > 0)
+        {
+            auto& edges = edgeLists_.at(vertex);
+            if (edges.empty())
+            {
+                edges = network_.vertexEdgeList(vertex);
+                relabel(vertex, epsilon);
+            }
+            else if (edges.begin()->residualCapacity() > 0 && reducedCost(*edges.begin()) < 0)
+            {
+                int flow(std::min(overage_.at(vertex), edges.begin()->residualCapacity()));
+                FLOW_STAT(stats_.countPush(flow == edges.begin()->residualCapacity()));
+                pushFlowImpl(edges.begin(), flow);
+            }
+            else
+                edges.popLastEdge();
+        }
+    }
+
+    // turns a 2ε-optimal (SCALING_FACTOR * ε) flow into an ε-optimal one
+    bool refine(long long epsilon)
+    {
+        FLOW_STAT(++stats_.phases);
+        overage_.assign(size_, 0);
+        for (int edgeId(0); edgeId < static_cast<int>(network_.edgesCount()); ++edgeId)
+        {
+            const Network::edge_t& edge = network_.edge(edgeId);
+            if (edge.residualCapacity() > 0 && reducedCost(edge) < 0)
+            {
+                overage_.at(edge.startVertex()) -= edge.residualCapacity();
+                overage_.at(edge.finishVertex()) += edge.residualCapacity();
+                network_.pushFlow(edgeId, edge.residualCapacity());
+            }
+        }
+        edgeLists_.clear();
+        for (int vertex(0); vertex < static_cast<int>(size_); ++vertex)
+        {
+            edgeLists_.push_back(network_.vertexEdgeList(vertex));
+            if (overage_.at(vertex) > 0)
+                activeVertices_.push(vertex);
+        }
+        while (!activeVertices_.empty())
+        {
+            if (isCancelled())
+            {
+                activeVertices_ = {};
+                return false;
+            }
+            int vertex(activeVertices_.front());
+            activeVertices_.pop();
+            discharge(vertex, epsilon);
+        }
+        return true;
+    }
+public:
+    bool run() final
+    {
+        if (!checkNetwork())
+            return false;
+        reset();
+        return resume();
+    }
+
+    bool resume() final
+    {
+        if (!checkNetwork() || !findMaximumFlow())
+            return false;
+        costScale_ = static_cast<long long>(size_) + 1;
+        potential_.assign(size_, 0);
+        long long epsilon(0);
+        for (const auto& edge : network_)
+            epsilon = std::max(epsilon, std::abs(edge.cost() * costScale_));
+        while (epsilon > 1)
+        {
+            epsilon = std::max(epsilon / SCALING_FACTOR, 1LL);
+            if (!refine(epsilon))
+                return false;
+        }
+        cost_ = flowCost();
+        return true;
+    }
+};
+
+/*
+ * Gomory-Hu tree of an undirected network (edges inserted with isDirected = false), Gusfield's version:
+ * n - 1 max-flows on the original network instead of contracted ones. The tree is flow-equivalent,
+ * the minimum cut between any two vertices is the lightest edge on their tree path.
+ * With several threads consecutive cuts are solved speculatively in parallel and redone
+ * whenever an earlier cut of the batch moved their tree parent.
+ */
+class GomoryHuTree
+{
+public:
+    using factory_t = std::function<std::unique_ptr<FlowFindingAlgorithm>()>;
+private:
+    struct cut_t
+    {
+        int parent = Network::NONE;
+        int value = 0;
+        std::vector<bool> sourceSide;
+    };
+
+    std::vector<std::unique_ptr<FlowFindingAlgorithm>> solvers_;
+    std::vector<int> parent_, weight_, depth_;
+    int size_;
+
+    static std::unique_ptr<FlowFindingAlgorithm> cutOnlySolver()
+    {
+        auto algorithm = std::make_unique<PreflowPushAlgorithm>();
+        algorithm->setCutOnly(true);
+        return algorithm;
+    }
+
+    void solveCut(FlowFindingAlgorithm& solver, int vertex, cut_t& cut)
+    {
+        Network network;
+        solver.storeNetwork(network);
+        network.setTerminals(vertex, cut.parent);
+        solver.loadNetwork(std::move(network));
+        solver.run();
+        cut.value = solver.result();
+        cut.sourceSide = solver.minCut();
+    }
+
+    void applyCut(int vertex, const cut_t& cut)
+    {
+        weight_.at(vertex) = cut.value;
+        for (int other(vertex + 1); other < static_cast<int>(parent_.size()); ++other)
+            if (cut.sourceSide.at(other) && parent_.at(other) == cut.parent)
+                parent_.at(other) = vertex;
+    }
+public:
+    explicit GomoryHuTree(Network&& network, size_t threadsCount = 1, factory_t factory = cutOnlySolver)
+        : size_(static_cast<int>(network.size()))
+    {
+        threadsCount = std::max<size_t>(threadsCount, 1);
+        for (size_t threadId(0); threadId < threadsCount; ++threadId)
+        {
+            solvers_.push_back(factory());
+            solvers_.back()->loadNetwork(threadId + 1 < threadsCount ? Network(network) : std::move(network));
+        }
+    }
+
+    void build()
+    {
+        parent_.assign(size_, 0);
+        weight_.assign(size_, Network::INF);
+        std::vector<cut_t> batch(solvers_.size());
+        for (int first(1); first < size_; first += static_cast<int>(batch.size()))
+        {
+            int batchSize(std::min(static_cast<int>(batch.size()), size_ - first));
+            std::vector<std::thread> threads;
+            for (int index(1); index < batchSize; ++index)
+            {
+                batch.at(index).parent = parent_.at(first + index);
+                threads.emplace_back(&GomoryHuTree::solveCut, this, std::ref(*solvers_.at(index)), first + index, std::ref(batch.at(index)));
+            }
+            batch.at(0).parent = parent_.at(first);
+            solveCut(*solvers_.at(0), first, batch.at(0));
+            for (auto& thread : threads)
+                thread.join();
+            for (int index(0); index < batchSize; ++index)
+            {
+                if (batch.at(index).parent != parent_.at(first + index))
+                {
+                    batch.at(index).parent = parent_.at(first + index);
+                    solveCut(*solvers_.at(0), first + index, batch.at(index));
+                }
+                applyCut(first + index, batch.at(index));
+            }
+        }
+        depth_.assign(size_, 0);
+        for (int vertex(1); vertex < size_; ++vertex)
+            depth_.at(vertex) = depth_.at(parent_.at(vertex)) + 1;
+    }
+
+    // tree edge (vertex, parent(vertex)) has weight(vertex), vertex 0 is the root
+    int parent(int vertex) const { return parent_.at(vertex); }
+    int weight(int vertex) const { return weight_.at(vertex); }
+
+    // O(length of the tree path), Network::INF for equal vertices
+    int minCut(int firstVertex, int secondVertex) const
+    {
+        int result(Network::INF);
+        while (firstVertex != secondVertex)
+        {
+            if (depth_.at(firstVertex) < depth_.at(secondVertex))
+                std::swap(firstVertex, secondVertex);
+            result = std::min(result, weight_.at(firstVertex));
+            firstVertex = parent_.at(firstVertex);
+        }
+        return result;
+    }
+};
+
+struct InputData
+{
+    size_t N;
+    std::vector<int> costs;
+    std::vector<std::vector<int>> depends;
+    static InputData read(std::istream& in)
+    {
+        size_t N;
+        in >> N;
+        std::vector<int> costs(N + 1);
+        for (size_t theme(1); theme <= N; ++theme)
+            in >> costs.at(theme);
+        std::vector<std::vector<int>> depends(1);
+        depends.reserve(N + 1);
+        for (size_t theme(1); theme <= N; ++theme)
+        {
+            size_t sizeOfDepends;
+            in >> sizeOfDepends;
+            depends.push_back(std::vector<int>(sizeOfDepends));
+            for (int& dependingTheme : depends.back())
+                in >> dependingTheme;
+        }
+        return {N, costs, depends};
+    }
+};
+
+template <typename T>
+struct array_view_t
+{
+    const T* items = nullptr;
+    size_t length = 0;
+
+    const T& at(size_t index) const
+    {
+        assert(index < length);
+        return items[index];
+    }
+    const T* begin() const { return items; }
+    const T* end() const { return items + length; }
+    size_t size() const { return length; }
+};
+
+// offsets + targets adjacency, at(theme) is the list of themes it depends on
+struct csr_view_t
+{
+    array_view_t<int> starts;
+    array_view_t<int> targets;
+
+    array_view_t<int> at(size_t theme) const
+    {
+        return {targets.begin() + starts.at(theme), static_cast<size_t>(starts.at(theme + 1) - starts.at(theme))};
+    }
+};
+
+/*
+ * Binary closure instance, native-endian int32 arrays after the header:
+ * costs[N + 1] (index 0 unused, like InputData), dependsStarts[N + 2], depends[dependsCount].
+ * map() loads a file without copying, N/costs/depends then mirror the fields of InputData.
+ */
+class BinaryInstance
+{
+private:
+    struct header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t themesCount;
+        uint32_t dependsCount;
+    };
+
+    constexpr static uint32_t MAGIC = 0x52534c43;   // "CLSR"
+    constexpr static uint32_t VERSION = 1;
+
+    void* mapping_ = nullptr;
+    size_t mappingSize_ = 0;
+
+    static size_t fileSize(size_t themesCount, size_t dependsCount)
+    {
+        return sizeof(header_t) + sizeof(int) * ((themesCount + 1) + (themesCount + 2) + dependsCount);
+    }
+
+    void unmap()
+    {
+        if (mapping_ != nullptr)
+            munmap(mapping_, mappingSize_);
+        mapping_ = nullptr;
+        mappingSize_ = 0;
+    }
+
+    // the views only assert their bounds, so a corrupted file must be rejected before anything reads it
+    bool valid() const
+    {
+        const int* starts(depends.starts.begin());
+        if (starts[0] < 0 || static_cast<size_t>(starts[N + 1]) > depends.targets.size())
+            return false;
+        for (size_t theme(0); theme <= N; ++theme)
+            if (starts[theme] > starts[theme + 1])
+                return false;
+        for (int target : depends.targets)
+            if (target < 1 || static_cast<size_t>(target) > N)
+                return false;
+        return true;
+    }
+public:
+    size_t N = 0;
+    array_view_t<int> costs;
+    csr_view_t depends;
+
+    BinaryInstance() = default;
+    BinaryInstance(const BinaryInstance&) = delete;
+    BinaryInstance& operator=(const BinaryInstance&) = delete;
+    ~BinaryInstance() { unmap(); }
+
+    bool map(const std::string& path)
+    {
+        unmap();
+        int fd(open(path.c_str(), O_RDONLY));
+        if (fd < 0)
+            return false;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || static_cast<size_t>(fileStat.st_size) < sizeof(header_t))
+        {
+            close(fd);
+            return false;
+        }
+        mappingSize_ = fileStat.st_size;
+        mapping_ = mmap(nullptr, mappingSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping_ == MAP_FAILED)
+        {
+            mapping_ = nullptr;
+            return false;
+        }
+        const auto* header = static_cast<const header_t*>(mapping_);
+        if (header->magic != MAGIC || header->version != VERSION
+                || mappingSize_ != fileSize(header->themesCount, header->dependsCount))
+        {
+            unmap();
+            return false;
+        }
+        N = header->themesCount;
+        const int* arrays = reinterpret_cast<const int*>(header + 1);
+        costs = {arrays, N + 1};
+        depends.starts = {arrays + N + 1, N + 2};
+        depends.targets = {arrays + 2 * N + 3, header->dependsCount};
+        if (!valid())
+        {
+            unmap();
+            N = 0;
+            costs = {};
+            depends = {};
+            return false;
+        }
+        return true;
+    }
+
+    InputData toInputData() const
+    {
+        InputData input{N, std::vector<int>(costs.begin(), costs.end()), std::vector<std::vector<int>>(N + 1)};
+        for (size_t theme(1); theme <= N; ++theme)
+            input.depends.at(theme).assign(depends.at(theme).begin(), depends.at(theme).end());
+        return input;
+    }
+
+    // streams the text format of InputData::read into the binary one without building per-theme vectors
+    static bool convert(std::istream& in, std::ostream& out)
+    {
+        size_t themesCount;
+        if (!(in >> themesCount))
+            return false;
+        std::vector<int> costs(themesCount + 1, 0), starts(themesCount + 2, 0), targets;
+        for (size_t theme(1); theme <= themesCount; ++theme)
+            in >> costs.at(theme);
+        for (size_t theme(1); theme <= themesCount; ++theme)
+        {
+            size_t sizeOfDepends;
+            in >> sizeOfDepends;
+            for (size_t index(0); index < sizeOfDepends; ++index)
+            {
+                int dependingTheme;
+                in >> dependingTheme;
+                targets.push_back(dependingTheme);
+            }
+            starts.at(theme + 1) = static_cast<int>(targets.size());
+        }
+        if (!in)
+            return false;
+        header_t header{MAGIC, VERSION, static_cast<uint32_t>(themesCount), static_cast<uint32_t>(targets.size())};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(costs.data()), sizeof(int) * costs.size());
+        out.write(reinterpret_cast<const char*>(starts.data()), sizeof(int) * starts.size());
+        out.write(reinterpret_cast<const char*>(targets.data()), sizeof(int) * targets.size());
+        return static_cast<bool>(out);
+    }
+};
+
+/*
+ * Reduction of a closure instance, dependencies are treated as hard constraints:
+ * strongly connected components of the dependency graph are taken or dropped together, so they become single themes;
+ * a component with non-negative cost whose dependencies are all forced is forced into the closure;
+ * a component with non-positive cost that nobody left depends on is dropped.
+ * Only undecided components are left in reduced.
+ */
+struct ClosureReduction
+{
+    InputData reduced;
+    int forcedCost = 0;
+    std::vector<int> reducedTheme;  // theme -> theme of reduced, Network::NONE for decided ones
+    std::vector<bool> isForced;     // decided themes that belong to the closure
+
+    template <typename Instance>
+    static ClosureReduction reduce(const Instance& input)
+    {
+        std::vector<int> component(condenseDependencies(input));
+        int componentsCount(*std::max_element(component.begin(), component.end()) + 1);
+
+        std::vector<int> componentCost(componentsCount, 0);
+        std::vector<std::vector<int>> componentDepends(componentsCount), componentDependants(componentsCount);
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+        {
+            componentCost.at(component.at(theme)) += input.costs.at(theme);
+            for (int depend : input.depends.at(theme))
+                if (component.at(depend) != component.at(theme))
+                    componentDepends.at(component.at(theme)).push_back(component.at(depend));
+        }
+        for (int current(1); current < componentsCount; ++current)
+        {
+            auto& depends = componentDepends.at(current);
+            std::sort(depends.begin(), depends.end());
+            depends.erase(std::unique(depends.begin(), depends.end()), depends.end());
+            for (int depend : depends)
+                componentDependants.at(depend).push_back(current);
+        }
+
+        // components are numbered in reverse topological order: dependencies come first
+        enum class Decision : int { Undecided, Forced, Dropped };
+        std::vector<Decision> decision(componentsCount, Decision::Undecided);
+        for (int current(1); current < componentsCount; ++current)
+            if (componentCost.at(current) >= 0 && std::all_of(
+                    componentDepends.at(current).begin(), componentDepends.at(current).end(),
+                    [&decision](int depend) { return decision.at(depend) == Decision::Forced; }))
+                decision.at(current) = Decision::Forced;
+        for (int current(componentsCount - 1); current > 0; --current)
+            if (decision.at(current) == Decision::Undecided && componentCost.at(current) <= 0 && std::all_of(
+                    componentDependants.at(current).begin(), componentDependants.at(current).end(),
+                    [&decision](int dependant) { return decision.at(dependant) == Decision::Dropped; }))
+                decision.at(current) = Decision::Dropped;
+
+        ClosureReduction reduction;
+        std::vector<int> reducedComponent(componentsCount, Network::NONE);
+        reduction.reduced.N = 0;
+        reduction.reduced.costs.assign(1, 0);
+        reduction.reduced.depends.assign(1, {});
+        for (int current(1); current < componentsCount; ++current)
+        {
+            if (decision.at(current) == Decision::Forced)
+                reduction.forcedCost += componentCost.at(current);
+            if (decision.at(current) != Decision::Undecided)
+                continue;
+            reducedComponent.at(current) = static_cast<int>(++reduction.reduced.N);
+            reduction.reduced.costs.push_back(componentCost.at(current));
+            reduction.reduced.depends.emplace_back();
+            for (int depend : componentDepends.at(current))
+                if (decision.at(depend) == Decision::Undecided)
+                    reduction.reduced.depends.back().push_back(reducedComponent.at(depend));
+        }
+
+        reduction.reducedTheme.assign(input.N + 1, Network::NONE);
+        reduction.isForced.assign(input.N + 1, false);
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+        {
+            reduction.reducedTheme.at(theme) = reducedComponent.at(component.at(theme));
+            reduction.isForced.at(theme) = decision.at(component.at(theme)) == Decision::Forced;
+        }
+        return reduction;
+    }
+
+    // maps a closure of reduced back to the themes of the original instance
+    std::vector<bool> expand(const std::vector<bool>& reducedClosure) const
+    {
+        std::vector<bool> closure(isForced);
+        for (int theme(1); theme < static_cast<int>(closure.size()); ++theme)
+            if (reducedTheme.at(theme) != Network::NONE)
+                closure.at(theme) = reducedClosure.at(reducedTheme.at(theme));
+        return closure;
+    }
+private:
+    // iterative Tarjan, components are numbered from 1 in the order they are completed
+    template <typename Instance>
+    static std::vector<int> condenseDependencies(const Instance& input)
+    {
+        std::vector<int> component(input.N + 1, 0), order(input.N + 1, 0), lowLink(input.N + 1, 0), nextDepend(input.N + 1, 0);
+        std::vector<int> stack, callStack;
+        std::vector<bool> onStack(input.N + 1, false);
+        int timer(0), componentsCount(1);
+        for (int root(1); root <= static_cast<int>(input.N); ++root)
+        {
+            if (order.at(root) != 0)
+                continue;
+            callStack.push_back(root);
+            while (!callStack.empty())
+            {
+                int theme(callStack.back());
+                if (nextDepend.at(theme) == 0 && order.at(theme) == 0)
+                {
+                    order.at(theme) = lowLink.at(theme) = ++timer;
+                    stack.push_back(theme);
+                    onStack.at(theme) = true;
+                }
+                if (nextDepend.at(theme) < static_cast<int>(input.depends.at(theme).size()))
+                {
+                    int depend(input.depends.at(theme).at(nextDepend.at(theme)++));
+                    if (order.at(depend) == 0)
+                        callStack.push_back(depend);
+                    else if (onStack.at(depend))
+                        lowLink.at(theme) = std::min(lowLink.at(theme), order.at(depend));
+                    continue;
+                }
+                callStack.pop_back();
+                if (!callStack.empty())
+                    lowLink.at(callStack.back()) = std::min(lowLink.at(callStack.back()), lowLink.at(theme));
+                if (lowLink.at(theme) != order.at(theme))
+                    continue;
+                int member;
+                do
+                {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack.at(member) = false;
+                    component.at(member) = componentsCount;
+                } while (member != theme);
+                ++componentsCount;
+            }
+        }
+        return component;
+    }
+};
+
+template <typename Instance>
+void buildClosureNetwork(const Instance& input, Network& graph, int& costsSum)
+{
+    graph.assign(input.N + 2, 0, input.N + 1);
+    size_t dependsCount(0);
+    for (size_t theme(1); theme <= input.N; ++theme)
+        dependsCount += input.depends.at(theme).size();
+    graph.reserveEdges(2 * (input.N + dependsCount));
+    costsSum = 0;
+    for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+    {
+        if (input.costs.at(theme) > 0)
+        {
+            costsSum += input.costs.at(theme);
+            graph.insertEdge(graph.source(), theme, input.costs.at(theme));
+        } else if (input.costs.at(theme) < 0) graph.insertEdge(theme, graph.sink(), -input.costs.at(theme));
+        for (int depend : input.depends.at(theme))
+            graph.insertEdge(theme, depend, Network::INF);
+    }
+}
+
+template <typename Instance>
+Network buildClosureNetwork(const Instance& input, int& costsSum)
+{
+    Network graph;
+    buildClosureNetwork(input, graph, costsSum);
+    return graph;
+}
+
+template <typename Algorithm, typename Instance>
+int solution(const Instance& input)
+{
+    ClosureReduction reduction(ClosureReduction::reduce(input));
+    int costsSum;
+    Network graph(buildClosureNetwork(reduction.reduced, costsSum));
+    std::unique_ptr<FlowFindingAlgorithm> algorithm = std::make_unique<Algorithm>();
+    algorithm->loadNetwork(std::move(graph));
+    algorithm->reset();
+    algorithm->run();
+    if (!algorithm->verifyFlow())
+    {
+        std::cerr << "flow certificate check failed" << std::endl;
+        std::abort();
+    }
+    algorithm->storeNetwork(graph);
+    return reduction.forcedCost + costsSum - algorithm->result();
+}
+
+/*
+ * Text instance read into CSR buffers that are reused by the next read(),
+ * N/costs/depends mirror the fields of InputData.
+ */
+class BatchInstance
+{
+private:
+    std::vector<int> costsBuffer_, startsBuffer_, targetsBuffer_;
+public:
+    size_t N = 0;
+    array_view_t<int> costs;
+    csr_view_t depends;
+
+    bool read(std::istream& in)
+    {
+        if (!(in >> N))
+            return false;
+        costsBuffer_.resize(N + 1);
+        costsBuffer_.at(0) = 0;
+        for (size_t theme(1); theme <= N; ++theme)
+            in >> costsBuffer_.at(theme);
+        startsBuffer_.resize(N + 2);
+        startsBuffer_.at(0) = startsBuffer_.at(1) = 0;
+        targetsBuffer_.clear();
+        for (size_t theme(1); theme <= N; ++theme)
+        {
+            size_t sizeOfDepends;
+            in >> sizeOfDepends;
+            for (size_t index(0); index < sizeOfDepends; ++index)
+            {
+                int dependingTheme;
+                in >> dependingTheme;
+                targetsBuffer_.push_back(dependingTheme);
+            }
+            startsBuffer_.at(theme + 1) = static_cast<int>(targetsBuffer_.size());
+        }
+        costs = {costsBuffer_.data(), costsBuffer_.size()};
+        depends = {{startsBuffer_.data(), startsBuffer_.size()}, {targetsBuffer_.data(), targetsBuffer_.size()}};
+        return static_cast<bool>(in);
+    }
+};
+
+/*
+ * Solves a stream of concatenated instances, answers in input order. Instances are read in rounds
+ * into a fixed set of slots and solved by a pool of workers, each with its own algorithm and network,
+ * so once the buffers have grown to the largest instance nothing is allocated per instance
+ * (a -DFLOW_ALLOCATION_CHECK build aborts if a worker does).
+ * Closure reduction is skipped: it pays off on large instances only and allocates.
+ */
+template <typename Algorithm>
+class BatchSolver
+{
+private:
+    constexpr static size_t SLOTS_PER_WORKER = 64;
+
+    struct slot_t
+    {
+        BatchInstance instance;
+        int result = 0;
+    };
+
+    struct worker_t
+    {
+        Algorithm algorithm;
+        Network network;
+        // largest instance solved so far, every buffer has grown to it
+        size_t maxThemes = 0;
+        size_t maxEdges = 0;
+    };
+
+    std::vector<slot_t> slots_;
+    std::vector<worker_t> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable roundStarted_, roundFinished_;
+    size_t round_ = 0;
+    size_t slotsCount_ = 0;
+    size_t finishedWorkers_ = 0;
+    bool isStopping_ = false;
+    std::atomic<size_t> nextSlot_{0};
+
+    // edges of the closure network without their reverse twins
+    static size_t edgesCount(const BatchInstance& instance) { return instance.N + instance.depends.targets.length; }
+
+    static int solve(worker_t& worker, const BatchInstance& instance)
+    {
+#ifdef FLOW_ALLOCATION_CHECK
+        size_t allocations(threadAllocations);
+        bool isWarm(instance.N <= worker.maxThemes && edgesCount(instance) <= worker.maxEdges);
+#endif
+        int costsSum;
+        buildClosureNetwork(instance, worker.network, costsSum);
+        worker.algorithm.loadNetwork(std::move(worker.network));
+        worker.algorithm.run();
+        if (!worker.algorithm.verifyFlow())
+        {
+            std::cerr << "flow certificate check failed" << std::endl;
+            std::abort();
+        }
+        worker.algorithm.storeNetwork(worker.network);
+#ifdef FLOW_ALLOCATION_CHECK
+        if (isWarm && threadAllocations != allocations)
+        {
+            std::cerr << "warmed-up batch worker allocated" << std::endl;
+            std::abort();
+        }
+#endif
+        worker.maxThemes = std::max(worker.maxThemes, instance.N);
+        worker.maxEdges = std::max(worker.maxEdges, edgesCount(instance));
+        return costsSum - worker.algorithm.result();
+    }
+
+    void solveSlots(size_t workerId)
+    {
+        for (size_t slot(nextSlot_++); slot < slotsCount_; slot = nextSlot_++)
+            slots_.at(slot).result = solve(workers_.at(workerId), slots_.at(slot).instance);
+    }
+
+    void work(size_t workerId)
+    {
+        size_t round(0);
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                roundStarted_.wait(lock, [&]() { return isStopping_ || round_ != round; });
+                if (isStopping_)
+                    return;
+                round = round_;
+            }
+            solveSlots(workerId);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++finishedWorkers_ == threads_.size())
+                roundFinished_.notify_one();
+        }
+    }
+
+    // the calling thread takes part as worker 0
+    void solveRound(size_t slotsCount)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slotsCount_ = slotsCount;
+            nextSlot_ = 0;
+            finishedWorkers_ = 0;
+            ++round_;
+        }
+        roundStarted_.notify_all();
+        solveSlots(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        roundFinished_.wait(lock, [&]() { return finishedWorkers_ == threads_.size(); });
+    }
+public:
+    explicit BatchSolver(size_t workersCount = 1)
+        : slots_(SLOTS_PER_WORKER * std::max<size_t>(workersCount, 1))
+        , workers_(std::max<size_t>(workersCount, 1))
+    {
+        // the workers already run in parallel, a parallel BFS inside each would only oversubscribe
+        for (auto& worker : workers_)
+            worker.algorithm.setBfsThreads(1);
+        for (size_t workerId(1); workerId < workers_.size(); ++workerId)
+            threads_.emplace_back(&BatchSolver::work, this, workerId);
+    }
+
+    ~BatchSolver()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            isStopping_ = true;
+        }
+        roundStarted_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    void run(std::istream& in, std::ostream& out)
+    {
+        size_t slotsCount;
+        do
+        {
+            slotsCount = 0;
+            while (slotsCount < slots_.size() && slots_.at(slotsCount).instance.read(in))
+                ++slotsCount;
+            solveRound(slotsCount);
+            for (size_t slot(0); slot < slotsCount; ++slot)
+                out << slots_.at(slot).result << '\n';
+        } while (slotsCount == slots_.size());
+        out.flush();
+    }
+};
+
+// themes of a maximum-weight closure as a bitset indexed by theme (index 0 is unused)
+std::vector<bool> optimalClosure(const InputData& input, FlowFindingAlgorithm& algorithm)
+{
+    ClosureReduction reduction(ClosureReduction::reduce(input));
+    int costsSum;
+    algorithm.loadNetwork(buildClosureNetwork(reduction.reduced, costsSum));
+    algorithm.run();
+    std::vector<bool> closure(algorithm.minCut());
+    closure.at(0) = false;
+    closure.pop_back();
+    return reduction.expand(closure);
+}
+
+std::vector<bool> optimalClosure(const InputData& input)
+{
+    PreflowPushAlgorithm algorithm;
+    algorithm.setCutOnly(true);
+    return optimalClosure(input, algorithm);
+}
+
+/*
+ * Maximum-weight closures while λ, added to every theme cost, grows (Gallo-Grigoriadis-Tarjan).
+ * Source edges only grow and sink edges only shrink, so the cut-only preflow of the previous sample
+ * stays valid and every solve continues from it.
+ * The breakpoints between two samples are found left to right where the lines of two closures cross
+ * (Eisner-Severance). Optimal closures are nested, so a probe between closures X ⊆ Y only decides
+ * the themes of Y \ X: X is contracted into the source, the themes outside Y into the sink, and the
+ * preflow of the previous sample, scaled along with the costs, is kept on what remains.
+ */
+class ParametricClosure
+{
+public:
+    struct sample_t
+    {
+        int lambda;
+        long long profit;
+        int closureSize;
+    };
+
+    struct breakpoint_t
+    {
+        double lambda;
+        int closureSizeBefore;
+        int closureSizeAfter;
+    };
+private:
+    // above every cut of the scaled networks, so a dependency is never cut
+    constexpr static int DEPENDENCY_CAPACITY = std::numeric_limits<int>::max() / 2;
+
+    // costs and size of a closure, its profit is costs + size * λ
+    struct line_t
+    {
+        long long costs;
+        int size;
+    };
+
+    InputData input_;
+    std::vector<int> sourceEdges_, sinkEdges_;
+    std::vector<std::vector<int>> dependEdges_, dependantEdges_;
+    // solved for the last sample
+    PreflowPushAlgorithm algorithm_;
+    long long costsSum_ = 0;
+    std::vector<sample_t> samples_;
+    std::vector<bool> closure_;
+    std::vector<breakpoint_t> breakpoints_;
+
+    // closures still to be crossed with the left one, the smallest at the back
+    std::vector<line_t> pendingLines_;
+    // how many pending closures contain the theme, NONE for the themes of the left closure
+    std::vector<int> depth_;
+    // the contracted network of a probe: source, the undecided themes, sink
+    PreflowPushAlgorithm probe_;
+    Network probeNetwork_;
+    std::vector<int> probeThemes_, probeVertices_;
+
+    bool advance(int lambda)
+    {
+        long long absoluteSum(0);
+        for (size_t theme(1); theme <= input_.N; ++theme)
+        {
+            absoluteSum += std::abs(input_.costs.at(theme) + lambda);
+            if (absoluteSum >= DEPENDENCY_CAPACITY)
+                return false;
+        }
+        Network network;
+        algorithm_.storeNetwork(network);
+        costsSum_ = 0;
+        for (size_t theme(1); theme <= input_.N; ++theme)
+        {
+            int cost(input_.costs.at(theme) + lambda);
+            costsSum_ += std::max(cost, 0);
+            network.setCapacity(sourceEdges_.at(theme), std::max(cost, 0));
+            int sinkEdge(sinkEdges_.at(theme));
+            network.setCapacity(sinkEdge, std::max(-cost, 0));
+            if (network.edge(sinkEdge).flow() > network.edge(sinkEdge).capacity())
+                network.pushFlow(sinkEdge, network.edge(sinkEdge).capacity() - network.edge(sinkEdge).flow());
+        }
+        algorithm_.loadNetwork(std::move(network));
+        return algorithm_.resume();
+    }
+
+    /*
+     * The largest optimal closure for λ = numerator / denominator (not below the last sample) between
+     * the left closure and the smallest pending one, themes it adds get one more pending closure.
+     * With every cost scaled by denominator, the flows of the last sample scaled the same way form
+     * a preflow: flow leaving to the contracted source is dropped, which only adds excess, and flow
+     * coming from the contracted sink stays on an edge from the sink.
+     */
+    bool probe(long long numerator, long long denominator, const line_t& left, line_t& line)
+    {
+        const Network& network = algorithm_.network();
+        int depth(static_cast<int>(pendingLines_.size()));
+        // all flow enters through the source edges or from the sink, so no flow exceeds inflow
+        long long inflow(0);
+        probeThemes_.assign(1, 0);
+        for (int theme(1); theme <= static_cast<int>(input_.N); ++theme)
+        {
+            probeVertices_.at(theme) = Network::NONE;
+            if (depth_.at(theme) != depth)
+                continue;
+            inflow += std::abs(input_.costs.at(theme) * denominator + numerator);
+            for (int edgeId : dependantEdges_.at(theme))
+                if (depth_.at(network.edge(edgeId).startVertex()) != depth)
+                    inflow += network.edge(edgeId).flow() * denominator;
+            if (inflow >= DEPENDENCY_CAPACITY)
+                return false;
+            probeVertices_.at(theme) = static_cast<int>(probeThemes_.size());
+            probeThemes_.push_back(theme);
+        }
+        int scale(static_cast<int>(denominator));
+        int sink(static_cast<int>(probeThemes_.size()));
+        probeNetwork_.assign(probeThemes_.size() + 1, 0, sink);
+        for (int vertex(1); vertex < sink; ++vertex)
+        {
+            int theme(probeThemes_.at(vertex));
+            int cost(static_cast<int>(input_.costs.at(theme) * denominator + numerator));
+            int sourceEdge(probeNetwork_.insertEdge(0, vertex, std::max(cost, 0)));
+            probeNetwork_.pushFlow(sourceEdge, network.edge(sourceEdges_.at(theme)).flow() * scale);
+            int sinkEdge(probeNetwork_.insertEdge(vertex, sink, std::max(-cost, 0)));
+            probeNetwork_.pushFlow(sinkEdge, std::min(network.edge(sinkEdges_.at(theme)).flow() * scale,
+                                                      std::max(-cost, 0)));
+            for (int edgeId : dependEdges_.at(theme))
+            {
+                int depend(network.edge(edgeId).finishVertex());
+                if (depth_.at(depend) == depth)
+                    probeNetwork_.pushFlow(probeNetwork_.insertEdge(vertex, probeVertices_.at(depend),
+                                                                    DEPENDENCY_CAPACITY),
+                                           network.edge(edgeId).flow() * scale);
+            }
+            for (int edgeId : dependantEdges_.at(theme))
+            {
+                int dependant(network.edge(edgeId).startVertex());
+                if (depth_.at(dependant) != depth && network.edge(edgeId).flow() > 0)
+                    probeNetwork_.pushFlow(probeNetwork_.insertEdge(sink, vertex, DEPENDENCY_CAPACITY),
+                                           network.edge(edgeId).flow() * scale);
+            }
+        }
+        probe_.loadNetwork(std::move(probeNetwork_));
+        bool isSolved(probe_.resume());
+        if (isSolved)
+        {
+            const std::vector<bool>& sourceSide = probe_.minCut();
+            line = left;
+            for (int vertex(1); vertex < sink; ++vertex)
+                if (sourceSide.at(vertex))
+                {
+                    line.costs += input_.costs.at(probeThemes_.at(vertex));
+                    ++line.size;
+                    ++depth_.at(probeThemes_.at(vertex));
+                }
+        }
+        probe_.storeNetwork(probeNetwork_);
+        return isSolved;
+    }
+
+    /*
+     * Breakpoints between the last sample and lambda, ends with lambda's closure pending. Probes where
+     * the left line crosses the smallest pending one: if nothing beats them there, it is a breakpoint
+     * and the pending closure becomes the left one, otherwise the better closure is pending too.
+     */
+    bool findBreakpoints(int lambda)
+    {
+        const sample_t& sample = samples_.back();
+        line_t left{sample.profit - static_cast<long long>(sample.closureSize) * sample.lambda, sample.closureSize};
+        for (size_t theme(1); theme <= input_.N; ++theme)
+            depth_.at(theme) = closure_.at(theme) ? Network::NONE : 0;
+        pendingLines_.clear();
+        line_t next;
+        if (!probe(lambda, 1, left, next))
+            return false;
+        pendingLines_.push_back(next);
+        while (!pendingLines_.empty())
+        {
+            next = pendingLines_.back();
+            int depth(static_cast<int>(pendingLines_.size()));
+            if (next.size != left.size)
+            {
+                long long numerator(left.costs - next.costs), denominator(next.size - left.size);
+                long long divisor(std::gcd(std::abs(numerator), denominator));
+                numerator /= divisor;
+                denominator /= divisor;
+                line_t middle;
+                if (!probe(numerator, denominator, left, middle))
+                    return false;
+                if (middle.costs * denominator + middle.size * numerator
+                        > left.costs * denominator + left.size * numerator)
+                {
+                    pendingLines_.push_back(middle);
+                    continue;
+                }
+                breakpoints_.push_back({static_cast<double>(numerator) / static_cast<double>(denominator),
+                                        left.size, next.size});
+            }
+            for (size_t theme(1); theme <= input_.N; ++theme)
+                if (depth_.at(theme) >= depth)
+                    depth_.at(theme) = Network::NONE;
+            left = next;
+            pendingLines_.pop_back();
+        }
+        return true;
+    }
+public:
+    explicit ParametricClosure(const InputData& input)
+        : input_(input)
+        , sourceEdges_(input.N + 1, Network::NONE)
+        , sinkEdges_(input.N + 1, Network::NONE)
+        , dependEdges_(input.N + 1)
+        , dependantEdges_(input.N + 1)
+        , depth_(input.N + 1, 0)
+        , probeVertices_(input.N + 1, Network::NONE)
+    {
+        Network network(input.N + 2, 0, input.N + 1);
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+        {
+            sourceEdges_.at(theme) = network.insertEdge(network.source(), theme, 0);
+            sinkEdges_.at(theme) = network.insertEdge(theme, network.sink(), 0);
+            for (int depend : input.depends.at(theme))
+            {
+                int edgeId(network.insertEdge(theme, depend, DEPENDENCY_CAPACITY));
+                dependEdges_.at(theme).push_back(edgeId);
+                dependantEdges_.at(depend).push_back(edgeId);
+            }
+        }
+        algorithm_.loadNetwork(std::move(network));
+        for (PreflowPushAlgorithm* algorithm : {&algorithm_, &probe_})
+            algorithm->setCutOnly(true);
+        algorithm_.setKeepHeights(true);
+    }
+
+    /*
+     * λ must be greater than in the previous call. Also finds the breakpoints since the previous sample;
+     * fails when λ or a breakpoint probe scales the costs beyond DEPENDENCY_CAPACITY.
+     */
+    bool solve(int lambda)
+    {
+        if (!samples_.empty() && (lambda <= samples_.back().lambda || !findBreakpoints(lambda)))
+            return false;
+        if (!advance(lambda))
+            return false;
+        closure_ = algorithm_.minCut();
+        closure_.at(0) = false;
+        closure_.pop_back();
+        int closureSize(static_cast<int>(std::count(closure_.begin(), closure_.end(), true)));
+        samples_.push_back({lambda, costsSum_ - algorithm_.result(), closureSize});
+        return true;
+    }
+
+    const std::vector<sample_t>& samples() const { return samples_; }
+
+    // the largest optimal closure for the last λ, indexed by theme
+    const std::vector<bool>& closure() const { return closure_; }
+
+    /*
+     * Every breakpoint between the first and the last sample: each closure C gives the line
+     * costs(C) + |C| * λ and the profit is linear between breakpoints, with the closure size as the slope.
+     */
+    const std::vector<breakpoint_t>& breakpoints() const { return breakpoints_; }
+};
+
+enum class PseudoflowOrder { LowestLabel, HighestLabel };
+
+/*
+ * Hochbaum's pseudoflow algorithm (HPF) working directly on the closure formulation of InputData:
+ * source and sink arcs are never materialized, every theme starts with excess equal to its cost
+ * and dependencies become arcs of capacity Network::INF, like in buildClosureNetwork.
+ * The normalized tree is kept in flat arrays indexed by theme, follows the layout of Chandran & Hochbaum's hpf.
+ * Strong trees that can't reach a weak node are lifted to nodesCount_, they form the optimal closure.
+ */
+class PseudoflowClosure
+{
+private:
+    struct arc_t
+    {
+        int from;
+        int to;
+        int flow;
+        int capacity;
+        bool direction;
+    };
+
+    PseudoflowOrder order_;
+
+    std::vector<arc_t> arcs_;
+    std::vector<int>
+            excess_,
+            label_,
+            parent_,
+            childList_,
+            next_,
+            nextScan_,
+            arcToParent_,
+            nextArc_,
+            outOfTreeStart_,
+            outOfTreeSize_,
+            outOfTree_,
+            labelCount_,
+            bucketStart_,
+            bucketEnd_;
+    int nodesCount_ = 0;
+    int currentLabel_ = 0;
+
+    int result_ = 0;
+    std::vector<bool> closure_;
+
+    void addToStrongBucket(int root)
+    {
+        int label(label_.at(root));
+        next_.at(root) = Network::NONE;
+        if (bucketStart_.at(label) == Network::NONE)
+            bucketStart_.at(label) = root;
+        else
+            next_.at(bucketEnd_.at(label)) = root;
+        bucketEnd_.at(label) = root;
+        if (order_ == PseudoflowOrder::LowestLabel)
+            currentLabel_ = std::min(currentLabel_, label);
+    }
+
+    int popFromStrongBucket(int label)
+    {
+        int root(bucketStart_.at(label));
+        bucketStart_.at(label) = next_.at(root);
+        next_.at(root) = Network::NONE;
+        return root;
+    }
+
+    void addRelationship(int newParent, int child)
+    {
+        parent_.at(child) = newParent;
+        next_.at(child) = childList_.at(newParent);
+        childList_.at(newParent) = child;
+    }
+
+    void breakRelationship(int oldParent, int child)
+    {
+        parent_.at(child) = Network::NONE;
+        if (childList_.at(oldParent) == child)
+            childList_.at(oldParent) = next_.at(child);
+        else
+        {
+            int current(childList_.at(oldParent));
+            while (next_.at(current) != child)
+                current = next_.at(current);
+            next_.at(current) = next_.at(child);
+        }
+        next_.at(child) = Network::NONE;
+    }
+
+    void addOutOfTree(int node, int arc)
+    {
+        outOfTree_.at(outOfTreeStart_.at(node) + outOfTreeSize_.at(node)++) = arc;
+    }
+
+    void prepare(const InputData& input)
+    {
+        nodesCount_ = static_cast<int>(input.N) + 2;
+        arcs_.clear();
+        outOfTreeStart_.assign(nodesCount_ + 1, 0);
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+            for (int depend : input.depends.at(theme))
+                if (depend != theme)
+                {
+                    arcs_.push_back({theme, depend, 0, Network::INF, true});
+                    ++outOfTreeStart_.at(theme + 1);
+                    ++outOfTreeStart_.at(depend + 1);
+                }
+        std::partial_sum(outOfTreeStart_.begin(), outOfTreeStart_.end(), outOfTreeStart_.begin());
+        outOfTree_.resize(outOfTreeStart_.back());
+        outOfTreeSize_.assign(nodesCount_, 0);
+        for (int arc(0); arc < static_cast<int>(arcs_.size()); ++arc)
+            addOutOfTree(arcs_.at(arc).from, arc);
+
+        excess_.assign(nodesCount_, 0);
+        label_.assign(nodesCount_, 0);
+        parent_.assign(nodesCount_, Network::NONE);
+        childList_.assign(nodesCount_, Network::NONE);
+        next_.assign(nodesCount_, Network::NONE);
+        nextScan_.assign(nodesCount_, Network::NONE);
+        arcToParent_.assign(nodesCount_, Network::NONE);
+        nextArc_.assign(nodesCount_, 0);
+        labelCount_.assign(nodesCount_ + 1, 0);
+        bucketStart_.assign(nodesCount_ + 1, Network::NONE);
+        bucketEnd_.assign(nodesCount_ + 1, Network::NONE);
+        currentLabel_ = order_ == PseudoflowOrder::LowestLabel ? nodesCount_ : 1;
+
+        label_.at(0) = label_.at(nodesCount_ - 1) = nodesCount_;
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+        {
+            excess_.at(theme) = input.costs.at(theme);
+            if (excess_.at(theme) > 0)
+            {
+                label_.at(theme) = 1;
+                addToStrongBucket(theme);
+            }
+            ++labelCount_.at(label_.at(theme));
+        }
+    }
+
+    void liftAll(int root)
+    {
+        int current(root);
+        nextScan_.at(current) = childList_.at(current);
+        --labelCount_.at(label_.at(current));
+        label_.at(current) = nodesCount_;
+        for (; current != Network::NONE; current = parent_.at(current))
+            while (nextScan_.at(current) != Network::NONE)
+            {
+                int child(nextScan_.at(current));
+                nextScan_.at(current) = next_.at(child);
+                current = child;
+                nextScan_.at(current) = childList_.at(current);
+                --labelCount_.at(label_.at(current));
+                label_.at(current) = nodesCount_;
+            }
+    }
+
+    // strong roots resting at label 0 are weak roots that received excess, they restart from label 1
+    void promoteZeroLabelRoots()
+    {
+        while (bucketStart_.at(0) != Network::NONE)
+        {
+            int root(popFromStrongBucket(0));
+            label_.at(root) = 1;
+            --labelCount_.at(0);
+            ++labelCount_.at(1);
+            addToStrongBucket(root);
+        }
+    }
+
+    int getHighestStrongRoot()
+    {
+        for (int label(currentLabel_); label > 0; --label)
+        {
+            if (bucketStart_.at(label) == Network::NONE)
+                continue;
+            currentLabel_ = label;
+            if (labelCount_.at(label - 1) > 0)
+                return popFromStrongBucket(label);
+            while (bucketStart_.at(label) != Network::NONE)
+                liftAll(popFromStrongBucket(label));
+        }
+        if (bucketStart_.at(0) == Network::NONE)
+            return Network::NONE;
+        promoteZeroLabelRoots();
+        currentLabel_ = 1;
+        return popFromStrongBucket(1);
+    }
+
+    int getLowestStrongRoot()
+    {
+        if (bucketStart_.at(0) != Network::NONE)
+        {
+            promoteZeroLabelRoots();
+            currentLabel_ = 1;
+        }
+        for (int label(std::max(currentLabel_, 1)); label < nodesCount_; ++label)
+        {
+            if (bucketStart_.at(label) == Network::NONE)
+                continue;
+            currentLabel_ = label;
+            if (labelCount_.at(label - 1) > 0)
+                return popFromStrongBucket(label);
+            while (bucketStart_.at(label) != Network::NONE)
+                liftAll(popFromStrongBucket(label));
+        }
+        currentLabel_ = nodesCount_;
+        return Network::NONE;
+    }
+
+    // out-of-tree residual arc from strongNode to a node with label weakLabel
+    int findWeakNode(int strongNode, int weakLabel, int& weakNode)
+    {
+        int start(outOfTreeStart_.at(strongNode));
+        for (int index(nextArc_.at(strongNode)); index < outOfTreeSize_.at(strongNode); ++index)
+        {
+            int arc(outOfTree_.at(start + index));
+            int neighbour(arcs_.at(arc).to == strongNode ? arcs_.at(arc).from : arcs_.at(arc).to);
+            if (label_.at(neighbour) == weakLabel)
+            {
+                nextArc_.at(strongNode) = index;
+                weakNode = neighbour;
+                outOfTree_.at(start + index) = outOfTree_.at(start + --outOfTreeSize_.at(strongNode));
+                return arc;
+            }
+        }
+        nextArc_.at(strongNode) = outOfTreeSize_.at(strongNode);
+        return Network::NONE;
+    }
+
+    void checkChildren(int node)
+    {
+        for (; nextScan_.at(node) != Network::NONE; nextScan_.at(node) = next_.at(nextScan_.at(node)))
+            if (label_.at(nextScan_.at(node)) == label_.at(node))
+                return;
+        --labelCount_.at(label_.at(node));
+        ++label_.at(node);
+        ++labelCount_.at(label_.at(node));
+        nextArc_.at(node) = 0;
+    }
+
+    // hangs the strong tree re-rooted at child under parent through newArc
+    void merge(int parent, int child, int newArc)
+    {
+        int current(child), newParent(parent);
+        while (parent_.at(current) != Network::NONE)
+        {
+            int oldArc(arcToParent_.at(current));
+            int oldParent(parent_.at(current));
+            arcToParent_.at(current) = newArc;
+            breakRelationship(oldParent, current);
+            addRelationship(newParent, current);
+            newParent = current;
+            current = oldParent;
+            newArc = oldArc;
+            arcs_.at(newArc).direction = !arcs_.at(newArc).direction;
+        }
+        arcToParent_.at(current) = newArc;
+        addRelationship(newParent, current);
+    }
+
+    // pushes min(excess, residual) from child to parent, splitting the tree if the arc gets exhausted
+    void pushToParent(int child, int parent)
+    {
+        arc_t& arc = arcs_.at(arcToParent_.at(child));
+        int residual(arc.direction ? arc.capacity - arc.flow : arc.flow);
+        if (residual >= excess_.at(child))
+        {
+            excess_.at(parent) += excess_.at(child);
+            arc.flow += arc.direction ? excess_.at(child) : -excess_.at(child);
+            excess_.at(child) = 0;
+            return;
+        }
+        arc.direction = !arc.direction;
+        arc.flow = arc.direction ? 0 : arc.capacity;
+        excess_.at(parent) += residual;
+        excess_.at(child) -= residual;
+        addOutOfTree(parent, arcToParent_.at(child));
+        breakRelationship(parent, child);
+        addToStrongBucket(child);
+    }
+
+    void pushExcess(int strongRoot)
+    {
+        int previousExcess(1);
+        int current(strongRoot);
+        while (excess_.at(current) != 0 && parent_.at(current) != Network::NONE)
+        {
+            int parent(parent_.at(current));
+            previousExcess = excess_.at(parent);
+            pushToParent(current, parent);
+            current = parent;
+        }
+        if (excess_.at(current) > 0 && previousExcess <= 0)
+            addToStrongBucket(current);
+    }
+
+    bool tryMerge(int strongRoot, int strongNode, int weakLabel)
+    {
+        int weakNode;
+        int arc(findWeakNode(strongNode, weakLabel, weakNode));
+        if (arc == Network::NONE)
+            return false;
+        merge(weakNode, strongNode, arc);
+        pushExcess(strongRoot);
+        return true;
+    }
+
+    void processRoot(int strongRoot)
+    {
+        int weakLabel(label_.at(strongRoot) - 1);
+        int strongNode(strongRoot);
+        nextScan_.at(strongRoot) = childList_.at(strongRoot);
+        if (tryMerge(strongRoot, strongRoot, weakLabel))
+            return;
+        checkChildren(strongRoot);
+        while (strongNode != Network::NONE)
+        {
+            while (nextScan_.at(strongNode) != Network::NONE)
+            {
+                int child(nextScan_.at(strongNode));
+                nextScan_.at(strongNode) = next_.at(child);
+                strongNode = child;
+                nextScan_.at(strongNode) = childList_.at(strongNode);
+                if (tryMerge(strongRoot, strongNode, weakLabel))
+                    return;
+                checkChildren(strongNode);
+            }
+            strongNode = parent_.at(strongNode);
+            if (strongNode != Network::NONE)
+                checkChildren(strongNode);
+        }
+        addToStrongBucket(strongRoot);
+        if (order_ == PseudoflowOrder::HighestLabel)
+            ++currentLabel_;
+    }
+public:
+    explicit PseudoflowClosure(PseudoflowOrder order = PseudoflowOrder::HighestLabel)
+        : order_(order)
+    {}
+
+    // returns the weight of a maximum-weight closure
+    int solve(const InputData& input)
+    {
+        prepare(input);
+        while (true)
+        {
+            int strongRoot(order_ == PseudoflowOrder::HighestLabel ? getHighestStrongRoot() : getLowestStrongRoot());
+            if (strongRoot == Network::NONE)
+                break;
+            processRoot(strongRoot);
+        }
+        result_ = 0;
+        closure_.assign(input.N + 1, false);
+        for (int theme(1); theme <= static_cast<int>(input.N); ++theme)
+            if (label_.at(theme) >= nodesCount_)
+            {
+                closure_.at(theme) = true;
+                result_ += input.costs.at(theme);
+            }
+        // dependency arcs have finite capacity Network::INF, the cut may pay for some of them as solution does
+        for (const arc_t& arc : arcs_)
+            if (closure_.at(arc.from) && !closure_.at(arc.to))
+                result_ -= arc.capacity;
+        return result_;
+    }
+
+    int result() const { return result_; }
+
+    // bitset indexed by theme, like optimalClosure
+    const std::vector<bool>& closure() const { return closure_; }
+};
+
+/*
+ * Max-flow benchmark: every (generator, size, algorithm) run happens in a forked child, so runs don't share
+ * ru_maxrss. child_peak_rss_kb is the whole child's peak, with the inherited pages, instance generation
+ * and network building; run_rss_growth_kb is how much the solve raised that peak, memory freed before
+ * the solve is reused first, so it's a lower bound of the solver's own memory.
+ * Results are printed as JSON lines, solver counters are included when built with -DFLOW_STATS.
+ */
+class FlowBenchmark
+{
+private:
+    struct algorithm_t
+    {
+        std::string name;
+        std::function<std::unique_ptr<FlowFindingAlgorithm>()> create;
+    };
+
+    // solvers working on InputData directly, measured on the instances behind closure networks
+    struct closure_algorithm_t
+    {
+        std::string name;
+        std::function<int(const InputData&)> solve;
+    };
+
+    struct generator_t
+    {
+        std::string name;
+        std::function<Network(size_t, std::mt19937&)> generate;
+        // the instance generate() builds its network from, empty unless it's a closure network
+        std::function<InputData(size_t, std::mt19937&)> instance = nullptr;
+    };
+
+    struct measurement_t
+    {
+        int flow;
+        double wallMs;
+        SolverStats stats;
+        long childPeakRssKb;
+        long runRssGrowthKb;
+    };
+
+    static long peakRssKb()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    static int randomCapacity(std::mt19937& random, int maxCapacity)
+    {
+        return std::uniform_int_distribution<int>(1, maxCapacity)(random);
+    }
+
+    static Network randomNetwork(size_t N, size_t M, std::mt19937& random, int maxCapacity = 100)
+    {
+        Network network(N, 0, static_cast<int>(N) - 1);
+        network.reserveEdges(2 * M);
+        std::uniform_int_distribution<int> vertex(0, static_cast<int>(N) - 1);
+        for (size_t edge(0); edge < M; ++edge)
+        {
+            int startVertex(vertex(random)), finishVertex(vertex(random));
+            if (startVertex != finishVertex)
+                network.insertEdge(startVertex, finishVertex, randomCapacity(random, maxCapacity));
+        }
+        return network;
+    }
+
+    static Network sparseNetwork(size_t N, std::mt19937& random) { return randomNetwork(N, 4 * N, random); }
+
+    static Network denseNetwork(size_t N, std::mt19937& random) { return randomNetwork(N, N * N / 4, random); }
+
+    // capacities close to INF, catches solvers that mistake a large residual for an infinite one
+    static Network hugeCapacityNetwork(size_t N, std::mt19937& random)
+    {
+        return randomNetwork(N, 4 * N, random, Network::INF - 1);
+    }
+
+    // square layers, every vertex is connected to its grid neighbours and to a few random vertices of the next layer
+    static Network layeredGridNetwork(size_t N, std::mt19937& random)
+    {
+        int side(std::max(2, static_cast<int>(std::cbrt(static_cast<double>(N)))));
+        int layerSize(side * side);
+        Network network(side * layerSize + 2, 0, side * layerSize + 1);
+        auto id = [&](int layer, int row, int column) { return 1 + layer * layerSize + row * side + column; };
+        std::uniform_int_distribution<int> cell(0, layerSize - 1);
+        for (int layer(0); layer < side; ++layer)
+            for (int row(0); row < side; ++row)
+                for (int column(0); column < side; ++column)
+                {
+                    int vertex(id(layer, row, column));
+                    if (layer == 0)
+                        network.insertEdge(network.source(), vertex, Network::INF);
+                    if (layer + 1 == side)
+                        network.insertEdge(vertex, network.sink(), Network::INF);
+                    if (row + 1 < side)
+                        network.insertEdge(vertex, id(layer, row + 1, column), randomCapacity(random, 1000), false);
+                    if (column + 1 < side)
+                        network.insertEdge(vertex, id(layer, row, column + 1), randomCapacity(random, 1000), false);
+                    if (layer + 1 < side)
+                        for (int edge(0); edge < 3; ++edge)
+                            network.insertEdge(vertex, 1 + (layer + 1) * layerSize + cell(random), randomCapacity(random, 1000));
+                }
+        return network;
+    }
+
+    // image segmentation style: a 4-connected grid with undirected smoothness edges, every pixel is tied to the source or the sink
+    static Network segmentationGridNetwork(size_t N, std::mt19937& random)
+    {
+        int side(std::max(2, static_cast<int>(std::sqrt(static_cast<double>(N)))));
+        Network network(side * side + 2, 0, side * side + 1);
+        for (int row(0); row < side; ++row)
+            for (int column(0); column < side; ++column)
+            {
+                int vertex(1 + row * side + column);
+                int likelihood(randomCapacity(random, 200) - 100);
+                if (likelihood > 0)
+                    network.insertEdge(network.source(), vertex, likelihood);
+                else
+                    network.insertEdge(vertex, network.sink(), 1 - likelihood);
+                if (row + 1 < side)
+                    network.insertEdge(vertex, vertex + side, randomCapacity(random, 50), false);
+                if (column + 1 < side)
+                    network.insertEdge(vertex, vertex + 1, randomCapacity(random, 50), false);
+            }
+        return network;
+    }
+
+    /*
+     * AK-style hard instance (after Cherkassky & Goldberg): a long path whose vertices each leak to the sink
+     * through a decreasing capacity, next to a path of unit "teeth" feeding a complete bipartite block.
+     * Push-relabel keeps relabelling along the paths, level-graph methods need many phases.
+     */
+    static Network akStyleNetwork(size_t N, std::mt19937& random)
+    {
+        int k(std::max(2, static_cast<int>(N) / 4));
+        Network network(4 * k + 2, 0, 4 * k + 1);
+        for (int index(1); index < k; ++index)
+        {
+            network.insertEdge(index, index + 1, Network::INF);
+            network.insertEdge(index, network.sink(), k - index + 1);
+            network.insertEdge(k + index, k + index + 1, Network::INF);
+            network.insertEdge(k + index, 2 * k + index, 1);
+        }
+        network.insertEdge(network.source(), 1, Network::INF);
+        network.insertEdge(network.source(), k + 1, Network::INF);
+        network.insertEdge(k, network.sink(), 1);
+        network.insertEdge(2 * k, 2 * k + k, 1);
+        for (int left(2 * k + 1); left <= 3 * k; ++left)
+            for (int edge(0); edge < 4; ++edge)
+                network.insertEdge(left, 3 * k + 1 + static_cast<int>(random() % k), 1);
+        for (int right(3 * k + 1); right <= 4 * k; ++right)
+            network.insertEdge(right, network.sink(), 1);
+        return network;
+    }
+
+    static Network bipartiteNetwork(size_t N, std::mt19937& random)
+    {
+        int half(std::max(1, static_cast<int>(N) / 2));
+        Network network(2 * half + 2, 0, 2 * half + 1);
+        std::uniform_int_distribution<int> right(half + 1, 2 * half);
+        for (int left(1); left <= half; ++left)
+        {
+            network.insertEdge(network.source(), left, 1);
+            network.insertEdge(half + left, network.sink(), 1);
+            for (int edge(0); edge < 5; ++edge)
+                network.insertEdge(left, right(random), 1);
+        }
+        return network;
+    }
+
+    static InputData closureInstance(size_t N, std::mt19937& random)
+    {
+        InputData input{N, std::vector<int>(N + 1, 0), std::vector<std::vector<int>>(N + 1)};
+        std::uniform_int_distribution<int> cost(-100, 100), theme(1, static_cast<int>(N)), dependsCount(0, 4);
+        for (size_t current(1); current <= N; ++current)
+        {
+            input.costs.at(current) = cost(random);
+            for (int edge(dependsCount(random)); edge > 0; --edge)
+                input.depends.at(current).push_back(theme(random));
+        }
+        return input;
+    }
+
+    static Network closureNetwork(size_t N, std::mt19937& random)
+    {
+        int costsSum;
+        return buildClosureNetwork(closureInstance(N, random), costsSum);
+    }
+
+    static measurement_t measure(const generator_t& generator, const algorithm_t& algorithm, size_t N)
+    {
+        std::mt19937 random(static_cast<unsigned>(N));
+        Network network(generator.generate(N, random));
+        std::unique_ptr<FlowFindingAlgorithm> solver(algorithm.create());
+        solver->loadNetwork(std::move(network));
+        long startRssKb(peakRssKb());
+        auto start(std::chrono::steady_clock::now());
+        solver->run();
+        auto finish(std::chrono::steady_clock::now());
+        long finishRssKb(peakRssKb());
+        return {solver->result(), std::chrono::duration<double, std::milli>(finish - start).count(),
+                solver->stats(), finishRssKb, finishRssKb - startRssKb};
+    }
+
+    static void printStats(std::ostream& out, const SolverStats& stats)
+    {
+        auto milliseconds = [](SolverStats::duration_t duration)
+        {
+            return std::chrono::duration<double, std::milli>(duration).count();
+        };
+        out << ",\"phases\":" << stats.phases
+            << ",\"bfs_runs\":" << stats.bfsRuns
+            << ",\"reference_vertices\":" << stats.referenceVertices
+            << ",\"pushes\":" << stats.pushes()
+            << ",\"saturating_pushes\":" << stats.saturatingPushes
+            << ",\"relabels\":" << stats.relabels
+            << ",\"discharges\":" << stats.discharges
+            << ",\"global_relabels\":" << stats.globalRelabels
+            << ",\"level_graph_ms\":" << milliseconds(stats.levelGraphTime)
+            << ",\"blocking_flow_ms\":" << milliseconds(stats.blockingFlowTime)
+            << ",\"discharge_ms\":" << milliseconds(stats.dischargeTime)
+            << ",\"global_relabel_ms\":" << milliseconds(stats.globalRelabelTime);
+    }
+
+    // reports the minimum cut, costs of the positive themes minus the closure weight, to compare with the flows
+    static measurement_t measureClosure(const generator_t& generator, const closure_algorithm_t& algorithm, size_t N)
+    {
+        std::mt19937 random(static_cast<unsigned>(N));
+        InputData input(generator.instance(N, random));
+        long startRssKb(peakRssKb());
+        auto start(std::chrono::steady_clock::now());
+        int weight(algorithm.solve(input));
+        auto finish(std::chrono::steady_clock::now());
+        long finishRssKb(peakRssKb());
+        assert(weight == solution<PreflowPushAlgorithm>(input));
+        int positiveCosts(0);
+        for (size_t theme(1); theme <= input.N; ++theme)
+            positiveCosts += std::max(input.costs.at(theme), 0);
+        return {positiveCosts - weight, std::chrono::duration<double, std::milli>(finish - start).count(),
+                SolverStats{}, finishRssKb, finishRssKb - startRssKb};
+    }
+
+    template <typename Measure>
+    static bool measureInChild(Measure measure, measurement_t& result)
+    {
+        int channel[2];
+        if (pipe(channel) != 0)
+            return false;
+        pid_t child(fork());
+        if (child < 0)
+            return false;
+        if (child == 0)
+        {
+            close(channel[0]);
+            measurement_t measurement(measure());
+            bool written(write(channel[1], &measurement, sizeof(measurement)) == sizeof(measurement));
+            _exit(written ? 0 : 1);
+        }
+        close(channel[1]);
+        bool received(read(channel[0], &result, sizeof(result)) == sizeof(result));
+        close(channel[0]);
+        int status;
+        waitpid(child, &status, 0);
+        return received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+public:
+    static std::vector<algorithm_t> algorithms()
+    {
+        return {
+                {"MalhotraKumarMaheshwari", []() { return std::make_unique<MalhotraKumarMaheshwari>(); }},
+                {"ScalingMalhotraKumarMaheshwari", []() {
+                    auto algorithm = std::make_unique<MalhotraKumarMaheshwari>();
+                    algorithm->setCapacityScaling(true);
+                    return algorithm; }},
+                {"DynamicTreeDinic", []() { return std::make_unique<DynamicTreeDinic>(); }},
+                {"ScalingDynamicTreeDinic", []() {
+                    auto algorithm = std::make_unique<DynamicTreeDinic>();
+                    algorithm->setCapacityScaling(true);
+                    return algorithm; }},
+                {"BoykovKolmogorov", []() { return std::make_unique<BoykovKolmogorov>(); }},
+                {"PreflowPushAlgorithm", []() { return std::make_unique<PreflowPushAlgorithm>(); }},
+                {"ParallelBfsPreflowPushAlgorithm", []() {
+                    auto algorithm = std::make_unique<PreflowPushAlgorithm>();
+                    algorithm->setBfsThreads(std::thread::hardware_concurrency());
+                    return algorithm; }},
+                {"ParallelPreflowPushAlgorithm", []() { return std::make_unique<ParallelPreflowPushAlgorithm>(); }},
+                {"PortfolioAlgorithm", []() { return std::make_unique<PortfolioAlgorithm>(); }},
+                {"MatchingFastPath", []() { return std::make_unique<MatchingFastPath<PreflowPushAlgorithm>>(); }},
+                {"ReorderedPreflowPushAlgorithm", []() {
+                    return std::make_unique<ReorderedAlgorithm<PreflowPushAlgorithm>>(VertexOrder::ReverseCuthillMcKee); }},
+        };
+    }
+
+    static std::vector<closure_algorithm_t> closureAlgorithms()
+    {
+        return {
+                {"PseudoflowClosure", [](const InputData& input) { return PseudoflowClosure().solve(input); }},
+                {"LowestLabelPseudoflowClosure", [](const InputData& input) {
+                    return PseudoflowClosure(PseudoflowOrder::LowestLabel).solve(input); }},
+        };
+    }
+
+    static std::vector<generator_t> generators()
+    {
+        return {
+                {"sparse", sparseNetwork},
+                {"dense", denseNetwork},
+                {"huge_capacity", hugeCapacityNetwork},
+                {"layered_grid", layeredGridNetwork},
+                {"segmentation_grid", segmentationGridNetwork},
+                {"ak", akStyleNetwork},
+                {"bipartite", bipartiteNetwork},
+                {"closure", closureNetwork, closureInstance},
+        };
+    }
+
+    static void print(std::ostream& out, const generator_t& generator, size_t N, const std::string& algorithm,
+                      bool isMeasured, const measurement_t& measurement)
+    {
+        out << "{\"generator\":\"" << generator.name << "\",\"size\":" << N
+            << ",\"algorithm\":\"" << algorithm << "\"";
+        if (isMeasured)
+        {
+            out << ",\"flow\":" << measurement.flow
+                << ",\"wall_ms\":" << measurement.wallMs
+                << ",\"child_peak_rss_kb\":" << measurement.childPeakRssKb
+                << ",\"run_rss_growth_kb\":" << measurement.runRssGrowthKb;
+            if (SolverStats::enabled)
+                printStats(out, measurement.stats);
+        }
+        else
+            out << ",\"error\":true";
+        out << "}" << std::endl;
+    }
+
+    static void run(std::ostream& out, const std::vector<size_t>& sizes)
+    {
+        for (const auto& generator : generators())
+            for (size_t N : sizes)
+            {
+                for (const auto& algorithm : algorithms())
+                {
+                    measurement_t measurement;
+                    bool isMeasured(measureInChild([&]() { return measure(generator, algorithm, N); }, measurement));
+                    print(out, generator, N, algorithm.name, isMeasured, measurement);
+                }
+                if (!generator.instance)
+                    continue;
+                for (const auto& algorithm : closureAlgorithms())
+                {
+                    measurement_t measurement;
+                    bool isMeasured(measureInChild([&]() { return measureClosure(generator, algorithm, N); }, measurement));
+                    print(out, generator, N, algorithm.name, isMeasured, measurement);
+                }
+            }
+    }
+};
+
+void run()
 {
     auto data = InputData::read(std::cin);
     int result(solution<PreflowPushAlgorithm>(data));
-    assert(result == solution<MalhotraKumarMaheshwari>(data));
     std::cout << result << std::endl;
 }
 
+// the same answer as run(), cross-checked against it in debug builds
+void runPseudoflow()
+{
+    auto data = InputData::read(std::cin);
+    int result(PseudoflowClosure().solve(data));
+    assert(result == solution<PreflowPushAlgorithm>(data));
+    std::cout << result << std::endl;
+}
+
+int runBinary(const std::string& path)
+{
+    BinaryInstance data;
+    if (!data.map(path))
+    {
+        std::cerr << "can't load binary instance " << path << std::endl;
+        return 1;
+    }
+    std::cout << solution<PreflowPushAlgorithm>(data) << std::endl;
+    return 0;
+}
+
+int runParametric(int firstLambda, int lastLambda)
+{
+    auto data = InputData::read(std::cin);
+    ParametricClosure parametric(data);
+    if (!parametric.solve(firstLambda) || (lastLambda > firstLambda && !parametric.solve(lastLambda)))
+        return 1;
+    for (const auto& sample : parametric.samples())
+        std::cout << sample.lambda << ' ' << sample.profit << ' ' << sample.closureSize << '\n';
+    for (const auto& breakpoint : parametric.breakpoints())
+        std::cout << "breakpoint " << breakpoint.lambda << ' '
+                  << breakpoint.closureSizeBefore << ' ' << breakpoint.closureSizeAfter << '\n';
+    return 0;
+}
+
+void runBatch(size_t workersCount)
+{
+    BatchSolver<PreflowPushAlgorithm> solver(workersCount);
+    solver.run(std::cin, std::cout);
+}
+
+int convert(const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!BinaryInstance::convert(std::cin, out))
+    {
+        std::cerr << "can't convert instance to " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Flows                    solve the text instance from stdin
+ * Flows --pseudoflow       solve the text instance from stdin with PseudoflowClosure
+ * Flows --convert FILE     convert the text instance from stdin to the binary format
+ * Flows --binary FILE      solve a binary instance
+ * Flows --batch [THREADS]  solve concatenated text instances from stdin, one answer per line
+ * Flows --parametric L R   profits and closure sizes of the stdin instance with every cost shifted by λ = L and R,
+ *                          then the exact breakpoints between them (the profit is linear in between)
+ * Flows --benchmark [N..]  benchmark all algorithms on generated networks of sizes N (JSON lines to stdout)
+ */
 int main(int argc, char** argv)
 {
     std::ios_base::sync_with_stdio(false);
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() == 1 && args.at(0) == "--pseudoflow")
+    {
+        runPseudoflow();
+        return 0;
+    }
+    if (args.size() == 2 && args.at(0) == "--convert")
+        return convert(args.at(1));
+    if (args.size() == 2 && args.at(0) == "--binary")
+        return runBinary(args.at(1));
+    if (!args.empty() && args.size() <= 2 && args.at(0) == "--batch")
+    {
+        runBatch(args.size() == 2 ? std::stoul(args.at(1)) : 1);
+        return 0;
+    }
+    if (args.size() == 3 && args.at(0) == "--parametric")
+        return runParametric(std::stoi(args.at(1)), std::stoi(args.at(2)));
+    if (!args.empty() && args.at(0) == "--benchmark")
+    {
+        std::vector<size_t> sizes;
+        for (size_t index(1); index < args.size(); ++index)
+            sizes.push_back(std::stoul(args.at(index)));
+        if (sizes.empty())
+            sizes = {256, 1024, 4096};
+        FlowBenchmark::run(std::cout, sizes);
+        return 0;
+    }
     run();
 }
@@ -9,12 +9,118 @@ typedef struct {
     void	        * pointer;
 } symbol_t;
 
-static uint32_t 	* output;                               //out_buff
+typedef struct {
+    uint8_t     * start;                                    //first instruction of loop body
+    uint8_t     * exit;                                     //branch out of loop, patched by loop_end
+} loop_t;
+
+typedef struct {
+    size_t        depth;                                    //stack depth right after reservation, first stack argument is at sp there
+    size_t        words;                                    //reserved words including alignment padding
+} call_frame_t;
+
+/*
+ * code generator of one target, the code of expression tree is emitted only through it
+ * registers are preserved by called functions, so values live in them across calls, leaf_registers
+ * are not and need no saving in expressions without calls, scratch register is used only inside one operation
+ * vector backend implements the operations on BATCH_LANES consecutive rows at once, it has no calls
+ */
+typedef struct backend {
+    const int   * registers;                                //temporaries in order of allocation
+    size_t        registers_count;
+    const int   * leaf_registers;
+    size_t        leaf_registers_count;
+    const int   * argument_registers;
+    size_t        argument_registers_count;                 //further arguments are passed on stack
+    int           result_register;
+    int           scratch_register;
+    void (* start_compile)(size_t saved_registers);         //function prologue, save first temporaries, 0 for leaf function
+    void (* finish_compile)(size_t saved_registers);        //function epilogue and return
+    void (* mov_val)(int reg, int val);                     //move 32bit-value
+    void (* load_var)(int reg, void * pointer);             //load int stored at pointer
+    void (* load_slot)(int reg, int base, int slot);        //load int base[slot], base holds pointer
+    void (* bind_values)(int reg);                          //reg = pointer passed as first argument
+    void (* mov_reg)(int dst, int src);                     //mov dst, src
+    void (* push)(int reg);                                 //spill reg to stack
+    void (* pop)(int reg);                                  //restore reg from stack
+    void (* add)(int dst, int src);                         //dst += src
+    void (* sub)(int dst, int src);                         //dst -= src
+    void (* mul)(int dst, int src);                         //dst *= src
+    void (* neg)(int reg);                                  //reg = -reg
+    void (* shl)(int reg, int shift);                       //reg <<= shift
+    void (* shl_add)(int reg, int shift);                   //reg = (reg << shift) + reg
+    void (* shl_sub)(int reg, int shift);                   //reg = (reg << shift) - reg
+    void (* func_call)(void * pointer);                     //call func with args in argument registers, result in result register
+    call_frame_t (* reserve_arguments)(size_t count);       //room for arguments beyond argument registers, sp stays aligned for call
+    void (* store_argument)(int reg, call_frame_t frame, size_t argument);  //argument-th stack argument = reg
+    void (* release_arguments)(call_frame_t frame);         //free the room after call
+    //batch function is f(const int * const * columns, int * out, int n), out[row] is computed for every row < n
+    size_t        batch_reserved_registers;                 //first registers keep columns, out, n and current row
+    void (* start_batch)(size_t call_sites);                //prologue, frame keeps results of call sites for all lanes
+    void (* finish_batch)(size_t call_sites);               //epilogue and return
+    loop_t (* loop_begin)(int step);                        //leave loop if row + step > n
+    void (* loop_end)(loop_t loop, int step);               //row += step, jump to loop start
+    void (* load_column)(int reg, int slot, int lane);      //load columns[slot][row + lane], vector backend loads all lanes
+    void (* load_lanes)(int reg, int call_site);            //load results of call site computed for all lanes
+    void (* store_lane)(int reg, int call_site, int lane);  //save result of call site for one lane
+    void (* store_result)(int reg);                         //out[row] = reg, vector backend stores all lanes
+    const struct backend * vector;                          //SIMD backend for batch mode
+} backend_t;
+
+enum {
+    MAX_ARGS = 6,                                           //arguments of extern function, calls with more are rejected
+    BATCH_LANES = 4,                                        //32bit lanes of 128-bit NEON and SSE registers
+    MAX_BATCH_CALL_SITES = 64                               //more calls are not vectorized, frame offsets stay short
+};
+
+typedef enum {
+    BIND_ADDRESSES,                                         //variables are read from pointers of their symbols
+    BIND_VALUES,                                            //from array passed to compiled function, by slot of symbol
+    BIND_COLUMNS                                            //from columns passed to batch function, by slot of symbol
+} binding_t;
+
+/*
+ * expression tree is the IR between parser and backends, optimize() rewrites it before code generation
+ * NODE_SHL, NODE_SHL_ADD and NODE_SHL_SUB appear only after strength reduction of multiplication by constant
+ */
+typedef enum {
+    NODE_NUM,
+    NODE_VAR,
+    NODE_CALL,
+    NODE_NEG,
+    NODE_ADD,
+    NODE_SUB,
+    NODE_MUL,
+    NODE_SHL,                                               //x << value
+    NODE_SHL_ADD,                                           //(x << value) + x
+    NODE_SHL_SUB                                            //(x << value) - x
+} node_kind_t;
+
+typedef struct node {
+    node_kind_t         kind;
+    int                 value;                              //constant of NODE_NUM, shift of NODE_SHL*, slot of bound NODE_VAR, call site of batch NODE_CALL
+    void              * pointer;                            //variable of NODE_VAR, function of NODE_CALL
+    struct node       * children[MAX_ARGS];                 //operands or function arguments
+    size_t              children_count;
+    size_t              need;                               //registers to evaluate the subtree without spilling (Sethi-Ullman number)
+} node_t;
+
+static uint8_t   	* output;                               //out_buff
 static char 		* expr;                                 //expression without spaces
 static const symbol_t   * extern_symbols;                   //externs
 static size_t 		current_pos;                            //current processing position
+static const backend_t  * backend;                          //target of compilation
+static node_t           * nodes;                            //expression tree nodes, parser and optimize() create less than 3 per char of expr
+static size_t           nodes_count;
+static const int        * registers;                        //temporaries chosen for current expression
+static size_t           registers_count;
+static binding_t        binding;                            //where variables are read from
+static int              values_register;                    //holds values array for BIND_VALUES
+static int              batch_lane;                         //row of scalar code relative to current row in batch mode
+static bool             is_rejected;                        //expression can't be compiled, call has more than MAX_ARGS arguments
 
 static const uint32_t 	COND_AL = 0xE0000000;               //conditional prefix of instructions
+static const uint32_t 	COND_GT = 0xC0000000;
 
 static uint32_t
 shifted_bit(int i)                                          //1 << i
@@ -49,7 +155,62 @@ enum registers {
     LR = 14
 };
 
-static void write_instruction(uint32_t instruction);        //write instruction to out_buff
+enum neon_registers {
+    Q0 = 0,
+    Q1 = 1,
+    Q2 = 2,
+    Q3 = 3,
+    Q8 = 8,
+    Q9 = 9,
+    Q10 = 10,
+    Q11 = 11,
+    Q12 = 12,
+    Q13 = 13,
+    Q14 = 14,
+    Q15 = 15
+};
+
+enum x86_registers {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    X86_R8 = 8,
+    X86_R9 = 9,
+    X86_R10 = 10,
+    X86_R11 = 11,
+    X86_R12 = 12,
+    X86_R13 = 13,
+    X86_R14 = 14,
+    X86_R15 = 15
+};
+
+enum sse_registers {
+    XMM0 = 0,
+    XMM1 = 1,
+    XMM2 = 2,
+    XMM3 = 3,
+    XMM4 = 4,
+    XMM5 = 5,
+    XMM6 = 6,
+    XMM7 = 7,
+    XMM8 = 8,
+    XMM9 = 9,
+    XMM10 = 10,
+    XMM11 = 11,
+    XMM12 = 12,
+    XMM13 = 13,
+    XMM14 = 14,
+    XMM15 = 15
+};
+
+static void write_instruction(uint32_t instruction);        //write arm instruction to out_buff
+static void write_byte(uint8_t byte);                       //write one byte of x86 instruction to out_buff
+static void write_bytes(uint64_t value, int count);         //write count low bytes of value, little-endian
 
 //arm instructions
 static void mov_pure_value(int reg, uint8_t val, int rot);  //move 8bit-value with rotation (mov reg, #val, #rot)
@@ -62,31 +223,141 @@ static void add(int dst, int src);                          //add dst, dst, src
 static void sub(int dst, int src);                          //sub dst, dst, src
 static void mul(int dst, int src);                          //mul dst, dst, src
 static void ldr(int dst, int src);                          //ldr dst, [src]
+static void ldr_offset(int dst, int src, int offset);       //ldr dst, [src, #offset], offset < 4096
+static void rsb_zero(int reg);                              //rsb reg, reg, #0
+static void lsl(int reg, int shift);                        //mov reg, reg, lsl #shift
+static void add_lsl(int reg, int shift);                    //add reg, reg, reg, lsl #shift
+static void rsb_lsl(int reg, int shift);                    //rsb reg, reg, reg, lsl #shift
+static void adjust_sp(int bytes);                           //add sp, sp, #bytes or sub sp, sp, #-bytes
+static uint32_t arm_immediate(uint32_t value);              //rotated 8-bit operand, value must be encodable
+static void add_imm(int dst, int src, uint32_t value);      //add dst, src, #value, value < 65536
+static void add_scaled(int dst, int src, int index, int shift); //add dst, src, index, lsl #shift
+static void str_offset(int src, int dst, int offset);       //str src, [dst, #offset], offset < 4096
+static void cmp(int left, int right);                       //cmp left, right
+static void branch(uint32_t cond, uint8_t * target);        //b<cond> target
+
+//NEON instructions, vector registers are q0-q15
+static void neon_three(uint32_t opcode, int dst, int left, int right); //three registers of the same length
+static void neon_dup(int reg, int src);                     //vdup.32 reg, src
+static void neon_load(int reg, int src);                    //vld1.32 {reg}, [src]
+static void neon_store(int reg, int dst);                   //vst1.32 {reg}, [dst]
+
+//x86-64 instructions, values are 32bit, pointers 64bit
+static void x86_rex(bool wide, int reg, int rm);            //REX prefix if it is needed
+static void x86_modrm(int mod, int reg, int rm);
+static void x86_mov_val(int reg, int val);                  //mov   reg32, imm32
+static void x86_mov_pointer(int reg, void * pointer);       //movabs reg64, imm64
+static void x86_load(int dst, int src);                     //mov   dst32, [src64]
+static void x86_mov_reg(int dst, int src);                  //mov   dst32, src32
+static void x86_load_slot(int reg, int base, int slot);     //mov   reg32, [base64 + 4 * slot]
+static void x86_bind_values(int reg);                       //mov   reg64, rdi
+static void x86_push(int reg);                              //push  reg64
+static void x86_pop(int reg);                               //pop   reg64
+static void x86_add(int dst, int src);                      //add   dst32, src32
+static void x86_sub(int dst, int src);                      //sub   dst32, src32
+static void x86_mul(int dst, int src);                      //imul  dst32, src32
+static void x86_neg(int reg);                               //neg   reg32
+static void x86_shl(int reg, int shift);                    //shl   reg32, imm8
+static void x86_shl_add(int reg, int shift);                //lea   reg32, [reg + reg * 2^shift] when possible
+static void x86_shl_sub(int reg, int shift);                //through eax
+static void x86_mov_reg64(int dst, int src);                //mov   dst64, src64
+static void x86_add_imm(int reg, int8_t value);             //add   reg32, imm8
+static void x86_rex_index(bool wide, int reg, int index, int base);
+static void x86_memory(int reg, int base, int index, int offset); //modrm, sib and displacement of [base + 4 * index + offset], index < 0 if none
+
+//SSE2 instructions, vector registers are xmm0-xmm15, xmm15 is scratch, xmm14 is the temporary of sse_mul
+static void sse_op(uint16_t opcode, int dst, int src);      //66 0F opcode, dst is reg of modrm
+static void sse_move(uint8_t opcode, int reg, int base, int index, int offset); //F3 0F opcode, movdqu with memory
 
 //parse and compile functions
-static void * get_current_symbol();                         //get pointer to extern symbol with name starting at current_pos and move current_pos aftern the end of name
-static void start_compile();                                //push {...}
-static void finish_compile();                               //pop {...}, bx lr
+static const symbol_t * get_current_symbol();               //get extern symbol (terminating one if unknown) with name starting at current_pos and move current_pos aftern the end of name
+static void start_compile(size_t saved_registers);          //push {r4-..., lr}
+static void finish_compile(size_t saved_registers);         //pop {r4-..., lr}, bx lr
+static void x86_start_compile(size_t saved_registers);      //push used callee-saved registers
+static void x86_finish_compile(size_t saved_registers);     //pop them, ret
+
+static void func_call(void * pointer);                      //call func, lr is saved by start_compile
+static void x86_func_call(void * pointer);                  //call func with aligned stack
 
-static void func_call(void * pointer);                      //call func, save result to R0
+static void arm_start_batch(size_t call_sites);             //push {r4-r12, lr}, r4-r7 = columns, out, n, row
+static call_frame_t arm_reserve_arguments(size_t count);    //sub sp, arguments 5+ of AAPCS call are at [sp] then
+static void x86_start_batch(size_t call_sites);             //push callee-saved registers, rbx, rbp, r12, r13 = columns, out, n, row
 
 /*
  * is_part_of_mul = true, if ... * expr
  * is_after_unary_operator = true, if ... +expr or ... -expr, where + and - are unary
- * result saved to R0
+ * returns tree of the parsed expression
  */
-static void parse_expr(bool is_part_of_mul, bool is_after_unary_operator);
-static void parse_num();                                    //save decimal constant to R0
-static void process_var(void * pointer);                    //save value of var to R0
-static void process_function(void * pointer);               //parse func args and call func, save result to R0
+static node_t * parse_expr(bool is_part_of_mul, bool is_after_unary_operator);
+static node_t * parse_num();                                //decimal constant
+static node_t * process_var(const symbol_t * symbol);       //value of var, bound to slot of its symbol unless BIND_ADDRESSES
+static node_t * process_function(void * pointer);           //parse func args, call of func
+static node_t * new_node(node_kind_t kind);
+static node_t * new_operation(node_kind_t kind, node_t * left, node_t * right);
 
-static void
+/*
+ * optimization passes, applied bottom-up in one walk: constant folding, identity elimination
+ * (x*1, x+0, x-0, 0-x, --x, x*0 without calls) and strength reduction of multiplication by constant
+ * to shifts with one add or sub, arithmetic wraps around like the generated code
+ */
+static node_t * optimize(node_t * node);                    //returns the node replacing this subtree
+static node_t * fold_constants(node_t * node);
+static node_t * eliminate_identities(node_t * node);
+static node_t * reduce_multiplication(node_t * node, node_t * factor, uint32_t constant);
+static node_t * new_shift(node_kind_t kind, node_t * child, int shift);
+
+/*
+ * Sethi-Ullman code generation: the operand needing more registers is evaluated first,
+ * so a tree with need <= registers_count is computed without memory traffic, bigger subtrees spill to stack
+ * result of generate(node, index) is saved to registers[index], registers before index are not touched
+ */
+static size_t label(node_t * node);                         //set need of every node of the subtree
+static bool has_calls(node_t * node);
+static void generate(node_t * node, size_t index);
+static void generate_operation(node_t * node, size_t index);
+static void generate_call(node_t * node, size_t index);
+static void emit_operation(node_kind_t kind, int dst, int src);
+
+/*
+ * batch mode: loop over BATCH_LANES rows runs outermost calls lane by lane, saves their results to frame
+ * and evaluates the rest of tree with vector backend, scalar loop computes the rows left
+ */
+static size_t number_call_sites(node_t * node, size_t count);   //returns count + number of outermost calls
+static void generate_lanes(node_t * node);                 //outermost calls of subtree for batch_lane
+static void generate_batch(node_t * root);
+
+static size_t           x86_stack_slots;                    //8-byte slots on stack since the call of compiled function, including return address
+static size_t           x86_frame_slots;                    //x86_stack_slots when frame of batch call sites was allocated
+static size_t           arm_stack_words;                    //4-byte words spilled to stack after the prologue
+
+static node_t *
+new_node(node_kind_t kind)
+{
+    node_t * node = &nodes[nodes_count++];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    return node;
+}
+
+static node_t *
+new_operation(node_kind_t kind, node_t * left, node_t * right)
+{
+    node_t * node = new_node(kind);
+    node->children[node->children_count++] = left;
+    if (right)
+        node->children[node->children_count++] = right;
+    return node;
+}
+
+static node_t *
 parse_num()
 {
     int num = 0;
     while (isdigit(expr[current_pos]))
         num = num * 10 + expr[current_pos++] - '0';
-    mov_val(R0, num);
+    node_t * node = new_node(NODE_NUM);
+    node->value = num;
+    return node;
 }
 
 static void
@@ -95,97 +366,441 @@ ldr(int dst, int src)
     write_instruction(
             COND_AL |
             shifted_bit(26) |
+            shifted_bit(24) |
+            shifted_bit(23) |
             shifted_bit(20) |
-            shifted_mask(dst, 16) |
-            shifted_mask(src, 12)
+            shifted_mask(src, 16) |
+            shifted_mask(dst, 12)
     );
 }
 
-static void
-process_var(void * pointer)
+static node_t *
+process_var(const symbol_t * symbol)
 {
-    mov_val(R0, (uint32_t)pointer);
-    ldr(R0, R0);
+    node_t * node = new_node(NODE_VAR);
+    if (binding != BIND_ADDRESSES)
+        node->value = symbol - extern_symbols;
+    else
+        node->pointer = symbol->pointer;
+    return node;
 }
 
-static void
+static node_t *
 process_function(void * pointer)
 {
     ++current_pos;
-    size_t argc = 0;
+    node_t * node = new_node(NODE_CALL);
+    node->pointer = pointer;
     while (expr[current_pos] != ')')
     {
-        ++argc;
         if (expr[current_pos] == ',')
             ++current_pos;
-        parse_expr(false, false);
-        push(shifted_bit(R0));
+        node_t * argument = parse_expr(false, false);
+        if (node->children_count < MAX_ARGS)
+            node->children[node->children_count++] = argument;
+        else
+            is_rejected = true;
     }
     ++current_pos;
-    while (argc)
-        pop(shifted_bit(--argc));
-    func_call(pointer);
+    return node;
 }
 
-static void
+static node_t *
 parse_expr(bool is_part_of_mul, bool is_after_unary_operator)
 {
+    node_t * result;
     if (expr[current_pos] == '(')
     {
         ++current_pos;
-        parse_expr(false, false);
+        result = parse_expr(false, false);
         ++current_pos;
     }
     else if (expr[current_pos] == '+' || expr[current_pos] == '-')
     {
         char sign = expr[current_pos++];
-        parse_expr(false, true);
+        result = parse_expr(false, true);
         if (sign == '-')
-        {
-            mov_val(R1, -1);
-            mul(R0, R1);
-        }
+            result = new_operation(NODE_NEG, result, NULL);
     }
     else if (isdigit(expr[current_pos]))
-        parse_num();
+        result = parse_num();
     else
     {
-        void * pointer = get_current_symbol();
+        const symbol_t * symbol = get_current_symbol();
         if (expr[current_pos] == '(')
-            process_function(pointer);
-        else process_var(pointer);
+            result = process_function(symbol->pointer);
+        else result = process_var(symbol);
     }
     if (is_after_unary_operator)
-        return;
+        return result;
     if (expr[current_pos] == '*')
     {
         ++current_pos;
-        push(shifted_bit(R0));
-        parse_expr(true, false);
-        pop(shifted_bit(R1));
-        mul(R0, R1);
+        result = new_operation(NODE_MUL, result, parse_expr(true, false));
     }
     if (!is_part_of_mul && (expr[current_pos] == '+' || expr[current_pos] == '-'))
     {
         char sign = expr[current_pos++];
-        push(shifted_bit(R0));
-        parse_expr(false, false);
-        pop(shifted_bit(R1));
-        if (sign == '+')
-            add(R0, R1);
+        result = new_operation(sign == '+' ? NODE_ADD : NODE_SUB, result, parse_expr(false, false));
+    }
+    return result;
+}
+
+static bool
+is_constant(node_t * node, uint32_t constant)
+{
+    return node->kind == NODE_NUM && (uint32_t)node->value == constant;
+}
+
+static bool
+is_power_of_two(uint32_t value)
+{
+    return value && !(value & (value - 1));
+}
+
+static int
+log2_of(uint32_t value)
+{
+    int result = 0;
+    while (value >>= 1)
+        ++result;
+    return result;
+}
+
+static node_t *
+new_shift(node_kind_t kind, node_t * child, int shift)
+{
+    node_t * node = new_operation(kind, child, NULL);
+    node->value = shift;
+    return node;
+}
+
+static node_t *
+optimize(node_t * node)
+{
+    for (size_t i = 0; i < node->children_count; ++i)
+        node->children[i] = optimize(node->children[i]);
+    node_t * folded = fold_constants(node);
+    return folded == node ? eliminate_identities(node) : folded;
+}
+
+static node_t *
+fold_constants(node_t * node)
+{
+    node_t * left = node->children[0], * right = node->children[1];
+    if (node->kind == NODE_NEG && left->kind == NODE_NUM)
+    {
+        left->value = (int)(0u - (uint32_t)left->value);
+        return left;
+    }
+    if ((node->kind != NODE_ADD && node->kind != NODE_SUB && node->kind != NODE_MUL)
+        || left->kind != NODE_NUM || right->kind != NODE_NUM)
+        return node;
+    uint32_t a = left->value, b = right->value;
+    if (node->kind == NODE_ADD)
+        left->value = (int)(a + b);
+    else if (node->kind == NODE_SUB)
+        left->value = (int)(a - b);
+    else
+        left->value = (int)(a * b);
+    return left;
+}
+
+static node_t *
+eliminate_identities(node_t * node)
+{
+    node_t * left = node->children[0], * right = node->children[1];
+    switch (node->kind)
+    {
+        case NODE_NEG:
+            return left->kind == NODE_NEG ? left->children[0] : node;
+        case NODE_ADD:
+            if (is_constant(left, 0))
+                return right;
+            return is_constant(right, 0) ? left : node;
+        case NODE_SUB:
+            if (is_constant(right, 0))
+                return left;
+            if (!is_constant(left, 0))
+                return node;
+            node->kind = NODE_NEG;                          //0 - x
+            node->children[0] = right;
+            node->children_count = 1;
+            return eliminate_identities(node);
+        case NODE_MUL:
+            if (left->kind == NODE_NUM)                     //constant goes right
+            {
+                node->children[0] = right;
+                node->children[1] = left;
+                return eliminate_identities(node);
+            }
+            if (right->kind != NODE_NUM || (right->value == 0 && has_calls(left)))
+                return node;
+            if (right->value == 0)
+                return right;
+            return reduce_multiplication(node, left, right->value);
+        default:
+            return node;
+    }
+}
+
+static node_t *
+reduce_multiplication(node_t * node, node_t * factor, uint32_t constant)
+{
+    if ((int32_t)constant < 0 && constant != 0x80000000u)
+    {
+        node_t * reduced = reduce_multiplication(node, factor, 0u - constant);
+        if (reduced == node)
+            return node;
+        return eliminate_identities(new_operation(NODE_NEG, reduced, NULL));
+    }
+    int shift = 0;
+    while (!(constant & 1))
+    {
+        constant >>= 1;
+        ++shift;
+    }
+    node_t * result;
+    if (constant == 1)
+        result = factor;
+    else if (is_power_of_two(constant - 1))
+        result = new_shift(NODE_SHL_ADD, factor, log2_of(constant - 1));
+    else if (is_power_of_two(constant + 1))
+        result = new_shift(NODE_SHL_SUB, factor, log2_of(constant + 1));
+    else
+        return node;
+    return shift ? new_shift(NODE_SHL, result, shift) : result;
+}
+
+static size_t
+label(node_t * node)
+{
+    node->need = 1;
+    if (node->kind == NODE_CALL)                            //argument i is kept in the i-th free register
+        for (size_t i = 0; i < node->children_count; ++i)
+        {
+            size_t need = i + label(node->children[i]);
+            if (need > node->need)
+                node->need = need;
+        }
+    else if (node->children_count == 1)
+        node->need = label(node->children[0]);
+    else if (node->children_count == 2)
+    {
+        size_t left = label(node->children[0]), right = label(node->children[1]);
+        node->need = left == right ? left + 1 : (left > right ? left : right);
+    }
+    return node->need;
+}
+
+static bool
+has_calls(node_t * node)
+{
+    if (node->kind == NODE_CALL)
+        return true;
+    for (size_t i = 0; i < node->children_count; ++i)
+        if (has_calls(node->children[i]))
+            return true;
+    return false;
+}
+
+static void
+emit_operation(node_kind_t kind, int dst, int src)
+{
+    if (kind == NODE_ADD)
+        backend->add(dst, src);
+    else if (kind == NODE_SUB)
+        backend->sub(dst, src);
+    else
+        backend->mul(dst, src);
+}
+
+static void
+generate(node_t * node, size_t index)
+{
+    int reg = registers[index];
+    switch (node->kind)
+    {
+        case NODE_NUM:
+            backend->mov_val(reg, node->value);
+            break;
+        case NODE_VAR:
+            if (binding == BIND_COLUMNS)
+                backend->load_column(reg, node->value, batch_lane);
+            else if (binding == BIND_VALUES)
+                backend->load_slot(reg, values_register, node->value);
+            else
+                backend->load_var(reg, node->pointer);
+            break;
+        case NODE_CALL:
+            if (backend->func_call)
+                generate_call(node, index);
+            else                                            //vector backend, calls were made lane by lane
+                backend->load_lanes(reg, node->value);
+            break;
+        case NODE_NEG:
+            generate(node->children[0], index);
+            backend->neg(reg);
+            break;
+        case NODE_SHL:
+            generate(node->children[0], index);
+            backend->shl(reg, node->value);
+            break;
+        case NODE_SHL_ADD:
+            generate(node->children[0], index);
+            backend->shl_add(reg, node->value);
+            break;
+        case NODE_SHL_SUB:
+            generate(node->children[0], index);
+            backend->shl_sub(reg, node->value);
+            break;
+        default:
+            generate_operation(node, index);
+    }
+}
+
+static void
+generate_operation(node_t * node, size_t index)
+{
+    node_t * left = node->children[0], * right = node->children[1];
+    size_t available = registers_count - index;
+    int reg = registers[index];
+    if (left->need >= right->need && right->need < available)
+    {
+        generate(left, index);
+        generate(right, index + 1);
+        emit_operation(node->kind, reg, registers[index + 1]);
+    }
+    else if (right->need > left->need && left->need < available)
+    {
+        generate(right, index);
+        generate(left, index + 1);
+        if (node->kind == NODE_SUB)
+        {
+            backend->sub(registers[index + 1], reg);
+            backend->mov_reg(reg, registers[index + 1]);
+        }
         else
+            emit_operation(node->kind, reg, registers[index + 1]);
+    }
+    else                                                    //both operands need all free registers
+    {
+        generate(right, index);
+        backend->push(reg);
+        generate(left, index);
+        backend->pop(backend->scratch_register);
+        emit_operation(node->kind, reg, backend->scratch_register);
+    }
+}
+
+static void
+generate_call(node_t * node, size_t index)
+{
+    size_t argc = node->children_count;
+    size_t in_registers = argc < backend->argument_registers_count ? argc : backend->argument_registers_count;
+    call_frame_t frame = {0, 0};
+    if (argc > in_registers)                                //arguments are still evaluated left to right
+        frame = backend->reserve_arguments(argc - in_registers);
+    if (index + argc <= registers_count)
+    {
+        for (size_t i = 0; i < argc; ++i)
+        {
+            generate(node->children[i], index + i);
+            if (i >= in_registers)
+                backend->store_argument(registers[index + i], frame, i - in_registers);
+        }
+        for (size_t i = 0; i < in_registers; ++i)
+            backend->mov_reg(backend->argument_registers[i], registers[index + i]);
+    }
+    else                                                    //not enough free registers to keep all arguments
+    {
+        for (size_t i = 0; i < argc; ++i)
         {
-            sub(R1, R0);
-            mov_reg(R0, R1);
+            generate(node->children[i], index);
+            if (i >= in_registers)
+                backend->store_argument(registers[index], frame, i - in_registers);
+            else
+                backend->push(registers[index]);
         }
+        while (in_registers)
+            backend->pop(backend->argument_registers[--in_registers]);
+    }
+    backend->func_call(node->pointer);
+    if (frame.words)
+        backend->release_arguments(frame);
+    backend->mov_reg(registers[index], backend->result_register);
+}
+
+static size_t
+number_call_sites(node_t * node, size_t count)
+{
+    if (node->kind == NODE_CALL)
+    {
+        node->value = count;
+        return count + 1;
+    }
+    for (size_t i = 0; i < node->children_count; ++i)
+        count = number_call_sites(node->children[i], count);
+    return count;
+}
+
+static void
+generate_lanes(node_t * node)
+{
+    if (node->kind == NODE_CALL)
+    {
+        generate(node, 0);
+        backend->store_lane(registers[0], node->value, batch_lane);
+        return;
+    }
+    for (size_t i = 0; i < node->children_count; ++i)
+        generate_lanes(node->children[i]);
+}
+
+static void
+generate_batch(node_t * root)
+{
+    const backend_t * scalar = backend;
+    const int * scalar_registers = scalar->registers + scalar->batch_reserved_registers;
+    size_t scalar_registers_count = scalar->registers_count - scalar->batch_reserved_registers;
+    size_t call_sites = number_call_sites(root, 0);
+    bool is_vectorized = call_sites <= MAX_BATCH_CALL_SITES;
+    if (!is_vectorized)
+        call_sites = 0;
+
+    registers = scalar_registers;
+    registers_count = scalar_registers_count;
+    scalar->start_batch(call_sites);
+    if (is_vectorized)
+    {
+        loop_t loop = scalar->loop_begin(BATCH_LANES);
+        for (batch_lane = 0; batch_lane < BATCH_LANES; ++batch_lane)
+            generate_lanes(root);
+        backend = scalar->vector;
+        registers = backend->registers;
+        registers_count = backend->registers_count;
+        generate(root, 0);
+        backend->store_result(registers[0]);
+        backend = scalar;
+        registers = scalar_registers;
+        registers_count = scalar_registers_count;
+        scalar->loop_end(loop, BATCH_LANES);
     }
+    batch_lane = 0;
+    loop_t loop = scalar->loop_begin(1);
+    generate(root, 0);
+    scalar->store_result(registers[0]);
+    scalar->loop_end(loop, 1);
+    scalar->finish_batch(call_sites);
 }
 
 static void
 func_call(void * pointer)
 {
-    mov_val(R4, (uint32_t)pointer);
-    push(shifted_bit(LR));
+    bool is_aligned = arm_stack_words % 2 == 0;             //sp must be 8-byte aligned at call
+    if (!is_aligned)
+        adjust_sp(-4);
+    mov_val(R12, (uint32_t)(uintptr_t)pointer);
     write_instruction(
             COND_AL |
             shifted_bit(24) |
@@ -193,37 +808,64 @@ func_call(void * pointer)
             shifted_mask(0xFFF, 8) |
             shifted_bit(5) |
             shifted_bit(4) |
-            R4
+            R12
     );
-    pop(shifted_bit(LR));
+    if (!is_aligned)
+        adjust_sp(4);
+}
+
+static const int arm_registers[] = {R4, R5, R6, R7, R8, R9, R10, R11};
+static const int arm_leaf_registers[] = {R0, R1, R2, R3};
+static const int arm_argument_registers[] = {R0, R1, R2, R3};
+
+static call_frame_t
+arm_reserve_arguments(size_t count)
+{
+    call_frame_t frame = {0, count + (arm_stack_words + count) % 2};
+    adjust_sp(-4 * (int)frame.words);
+    arm_stack_words += frame.words;
+    frame.depth = arm_stack_words;
+    return frame;
 }
 
 static void
-start_compile()
+arm_store_argument(int reg, call_frame_t frame, size_t argument)
 {
-    push(
-            shifted_bit(R4) |
-            shifted_bit(R5) |
-            shifted_bit(R6) |
-            shifted_bit(R7) |
-            shifted_bit(R8) |
-            shifted_bit(R9) |
-            shifted_bit(R10)
-    );
+    str_offset(reg, SP, 4 * (arm_stack_words - frame.depth + argument));
 }
 
 static void
-finish_compile()
+arm_release_arguments(call_frame_t frame)
 {
-    pop(
-            shifted_bit(R4) |
-            shifted_bit(R5) |
-            shifted_bit(R6) |
-            shifted_bit(R7) |
-            shifted_bit(R8) |
-            shifted_bit(R9) |
-            shifted_bit(R10)
-    );
+    adjust_sp(4 * (int)frame.words);
+    arm_stack_words -= frame.words;
+}
+static const int neon_registers[] = {Q0, Q1, Q2, Q3, Q8, Q9, Q10, Q11, Q12, Q13, Q14};   //q4-q7 are callee-saved
+
+static uint16_t
+saved_registers_list(size_t saved_registers)                //used temporaries and lr, r12 keeps stack 8-byte aligned
+{
+    uint16_t register_list = shifted_bit(LR);
+    for (size_t i = 0; i < saved_registers; ++i)
+        register_list |= shifted_bit(arm_registers[i]);
+    if (saved_registers % 2 == 0)
+        register_list |= shifted_bit(R12);
+    return register_list;
+}
+
+static void
+start_compile(size_t saved_registers)
+{
+    arm_stack_words = 0;
+    if (saved_registers)
+        push(saved_registers_list(saved_registers));
+}
+
+static void
+finish_compile(size_t saved_registers)
+{
+    if (saved_registers)
+        pop(saved_registers_list(saved_registers));
     write_instruction(
             COND_AL |
             shifted_bit(24) |
@@ -233,7 +875,27 @@ finish_compile()
     );
 }
 
-static void *
+static void
+arm_start_batch(size_t call_sites)
+{
+    start_compile(sizeof(arm_registers) / sizeof(arm_registers[0]));
+    mov_reg(R4, R0);
+    mov_reg(R5, R1);
+    mov_reg(R6, R2);
+    mov_pure_value(R7, 0, 0);
+    if (call_sites)
+        adjust_sp(-16 * (int)call_sites);
+}
+
+static void
+arm_finish_batch(size_t call_sites)
+{
+    if (call_sites)
+        adjust_sp(16 * (int)call_sites);
+    finish_compile(sizeof(arm_registers) / sizeof(arm_registers[0]));
+}
+
+static const symbol_t *
 get_current_symbol()
 {
     size_t j = current_pos;
@@ -246,27 +908,32 @@ get_current_symbol()
            && expr[current_pos] != ')'
             )
         ++current_pos;
-    void * pointer = 0;
     char buff = expr[current_pos];
     expr[current_pos] = '\0';
-    for (
-            const symbol_t * symbol = extern_symbols;
-            symbol->name;
-            ++symbol
-            )
-        if (strcmp(expr + j, symbol->name) == 0)
-        {
-            pointer = symbol->pointer;
-            break;
-        }
+    const symbol_t * symbol = extern_symbols;
+    while (symbol->name && strcmp(expr + j, symbol->name) != 0)
+        ++symbol;
     expr[current_pos] = buff;
-    return pointer;
+    return symbol;
 }
 
 static void
 write_instruction(uint32_t instruction)
 {
-    *(output++) = instruction;
+    write_bytes(instruction, 4);
+}
+
+static void
+write_byte(uint8_t byte)
+{
+    *(output++) = byte;
+}
+
+static void
+write_bytes(uint64_t value, int count)
+{
+    for (int i = 0; i < count; ++i)
+        write_byte((value >> (8 * i)) & 0xFF);
 }
 
 static void
@@ -385,26 +1052,1255 @@ mul(int dst, int src)
     );
 }
 
-void
-jit_compile_expression_to_arm(
-        const char      * expression,
-        const symbol_t  * externs,
-        void            * out_buffer
-)
+static void
+rsb_zero(int reg)
 {
-    expr = malloc(strlen(expression) + 1);
-    int i = 0;
-    for (int j = 0; expression[j]; ++j)
-        if (expression[j] != ' ')
-            expr[i++] = expression[j];
-    expr[i] = '\0';
-    extern_symbols = externs;
-    output = out_buffer;
+    write_instruction(
+            COND_AL |
+            shifted_bit(25) |
+            shifted_bit(22) |
+            shifted_bit(21) |
+            shifted_mask(reg, 16) |
+            shifted_mask(reg, 12)
+    );
+}
+
+static void
+lsl(int reg, int shift)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(24) |
+            shifted_bit(23) |
+            shifted_bit(21) |
+            shifted_mask(reg, 12) |
+            shifted_mask(shift, 7) |
+            reg
+    );
+}
 
-    start_compile();
-    parse_expr(false, false);
-    finish_compile();
+static void
+add_lsl(int reg, int shift)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(23) |
+            shifted_mask(reg, 16) |
+            shifted_mask(reg, 12) |
+            shifted_mask(shift, 7) |
+            reg
+    );
+}
 
-    free(expr);
+static void
+rsb_lsl(int reg, int shift)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(22) |
+            shifted_bit(21) |
+            shifted_mask(reg, 16) |
+            shifted_mask(reg, 12) |
+            shifted_mask(shift, 7) |
+            reg
+    );
+}
+
+static void
+arm_load_var(int reg, void * pointer)
+{
+    mov_val(reg, (uint32_t)(uintptr_t)pointer);
+    ldr(reg, reg);
 }
 
+static void
+ldr_offset(int dst, int src, int offset)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(26) |
+            shifted_bit(24) |
+            shifted_bit(23) |
+            shifted_bit(20) |
+            shifted_mask(src, 16) |
+            shifted_mask(dst, 12) |
+            offset
+    );
+}
+
+static void
+arm_load_slot(int reg, int base, int slot)
+{
+    int offset = 4 * slot;
+    if (offset < 4096)
+        ldr_offset(reg, base, offset);
+    else
+    {
+        mov_val(reg, offset);
+        add(reg, base);
+        ldr(reg, reg);
+    }
+}
+
+static void
+arm_bind_values(int reg)
+{
+    if (reg != R0)
+        mov_reg(reg, R0);
+}
+
+static void
+arm_push(int reg)
+{
+    push(shifted_bit(reg));
+    ++arm_stack_words;
+}
+
+static void
+arm_pop(int reg)
+{
+    pop(shifted_bit(reg));
+    --arm_stack_words;
+}
+
+static void
+adjust_sp(int bytes)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(25) |
+            shifted_bit(bytes < 0 ? 22 : 23) |
+            shifted_mask(SP, 16) |
+            shifted_mask(SP, 12) |
+            arm_immediate(bytes < 0 ? -bytes : bytes)
+    );
+}
+
+static uint32_t
+arm_immediate(uint32_t value)
+{
+    int rot = 0;
+    while (value > 0xFF && rot < 16)                        //value = imm8 ror (2 * rot)
+    {
+        value = (value << 2) | (value >> 30);
+        ++rot;
+    }
+    return shifted_mask(rot, 8) | value;
+}
+
+static void
+add_imm(int dst, int src, uint32_t value)
+{
+    uint32_t high = value & ~0xFFu, low = value & 0xFF;
+    if (high)
+    {
+        write_instruction(
+                COND_AL |
+                shifted_bit(25) |
+                shifted_bit(23) |
+                shifted_mask(src, 16) |
+                shifted_mask(dst, 12) |
+                arm_immediate(high)
+        );
+        src = dst;
+    }
+    if (low || !high)
+        write_instruction(
+                COND_AL |
+                shifted_bit(25) |
+                shifted_bit(23) |
+                shifted_mask(src, 16) |
+                shifted_mask(dst, 12) |
+                low
+        );
+}
+
+static void
+add_scaled(int dst, int src, int index, int shift)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(23) |
+            shifted_mask(src, 16) |
+            shifted_mask(dst, 12) |
+            shifted_mask(shift, 7) |
+            index
+    );
+}
+
+static void
+str_offset(int src, int dst, int offset)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(26) |
+            shifted_bit(24) |
+            shifted_bit(23) |
+            shifted_mask(dst, 16) |
+            shifted_mask(src, 12) |
+            offset
+    );
+}
+
+static void
+cmp(int left, int right)
+{
+    write_instruction(
+            COND_AL |
+            shifted_bit(24) |
+            shifted_bit(22) |
+            shifted_bit(20) |
+            shifted_mask(left, 16) |
+            right
+    );
+}
+
+static void
+branch(uint32_t cond, uint8_t * target)
+{
+    int32_t offset = (target - (output + 8)) / 4;           //pc is 8 bytes ahead
+    write_instruction(
+            cond |
+            shifted_bit(27) |
+            shifted_bit(25) |
+            ((uint32_t)offset & 0x00FFFFFF)
+    );
+}
+
+static void
+arm_load_column(int reg, int slot, int lane)
+{
+    arm_load_slot(reg, R4, slot);
+    add_scaled(reg, reg, R7, 2);
+    ldr_offset(reg, reg, 4 * lane);
+}
+
+static void
+arm_store_lane(int reg, int call_site, int lane)
+{
+    str_offset(reg, SP, 4 * arm_stack_words + 16 * call_site + 4 * lane);
+}
+
+static void
+arm_store_result(int reg)
+{
+    add_scaled(R12, R5, R7, 2);
+    str_offset(reg, R12, 0);
+}
+
+static loop_t
+arm_loop_begin(int step)
+{
+    loop_t loop;
+    loop.start = output;
+    add_imm(R12, R7, step);
+    cmp(R12, R6);
+    loop.exit = output;
+    write_instruction(0);                                   //bgt to the end of loop, patched by arm_loop_end
+    return loop;
+}
+
+static void
+arm_loop_end(loop_t loop, int step)
+{
+    add_imm(R7, R7, step);
+    branch(COND_AL, loop.start);
+    uint8_t * end = output;
+    output = loop.exit;
+    branch(COND_GT, end);
+    output = end;
+}
+
+static void
+neon_three(uint32_t opcode, int dst, int left, int right)
+{
+    write_instruction(
+            opcode |
+            shifted_mask((2 * dst) >> 4, 22) |
+            shifted_mask((2 * left) & 15, 16) |
+            shifted_mask((2 * dst) & 15, 12) |
+            shifted_mask((2 * left) >> 4, 7) |
+            shifted_mask((2 * right) >> 4, 5) |
+            ((2 * right) & 15)
+    );
+}
+
+static void
+neon_dup(int reg, int src)
+{
+    write_instruction(
+            0xEEA00B10 |
+            shifted_mask((2 * reg) & 15, 16) |
+            shifted_mask(src, 12) |
+            shifted_mask((2 * reg) >> 4, 7)
+    );
+}
+
+static void
+neon_load(int reg, int src)
+{
+    write_instruction(
+            0xF4200A8F |
+            shifted_mask((2 * reg) >> 4, 22) |
+            shifted_mask(src, 16) |
+            shifted_mask((2 * reg) & 15, 12)
+    );
+}
+
+static void
+neon_store(int reg, int dst)
+{
+    write_instruction(
+            0xF4000A8F |
+            shifted_mask((2 * reg) >> 4, 22) |
+            shifted_mask(dst, 16) |
+            shifted_mask((2 * reg) & 15, 12)
+    );
+}
+
+static void
+neon_splat(int reg, int val)
+{
+    mov_val(R12, val);
+    neon_dup(reg, R12);
+}
+
+static void
+neon_load_column(int reg, int slot, int lane)
+{
+    (void)lane;                                             //all lanes are loaded
+    arm_load_slot(R12, R4, slot);
+    add_scaled(R12, R12, R7, 2);
+    neon_load(reg, R12);
+}
+
+static void
+neon_load_lanes(int reg, int call_site)
+{
+    add_imm(R12, SP, 4 * arm_stack_words + 16 * call_site);
+    neon_load(reg, R12);
+}
+
+static void
+neon_store_result(int reg)
+{
+    add_scaled(R12, R5, R7, 2);
+    neon_store(reg, R12);
+}
+
+static void
+neon_mov(int dst, int src)                                  //vorr dst, src, src
+{
+    neon_three(0xF2200150, dst, src, src);
+}
+
+static void
+neon_push(int reg)                                          //vpush {d2n, d2n+1}
+{
+    write_instruction(0xED2D0B04 | shifted_mask((2 * reg) >> 4, 22) | shifted_mask((2 * reg) & 15, 12));
+    arm_stack_words += 4;
+}
+
+static void
+neon_pop(int reg)                                           //vpop {d2n, d2n+1}
+{
+    write_instruction(0xECBD0B04 | shifted_mask((2 * reg) >> 4, 22) | shifted_mask((2 * reg) & 15, 12));
+    arm_stack_words -= 4;
+}
+
+static void
+neon_add(int dst, int src)                                  //vadd.i32
+{
+    neon_three(0xF2200840, dst, dst, src);
+}
+
+static void
+neon_sub(int dst, int src)                                  //vsub.i32
+{
+    neon_three(0xF3200840, dst, dst, src);
+}
+
+static void
+neon_mul(int dst, int src)                                  //vmul.i32
+{
+    neon_three(0xF2200950, dst, dst, src);
+}
+
+static void
+neon_neg(int reg)                                           //vneg.s32
+{
+    write_instruction(
+            0xF3B903C0 |
+            shifted_mask((2 * reg) >> 4, 22) |
+            shifted_mask((2 * reg) & 15, 12) |
+            shifted_mask((2 * reg) >> 4, 5) |
+            ((2 * reg) & 15)
+    );
+}
+
+static void
+neon_shift(int dst, int src, int shift)                     //vshl.i32 dst, src, #shift
+{
+    write_instruction(
+            0xF2800550 |
+            shifted_mask((2 * dst) >> 4, 22) |
+            shifted_mask(32 + shift, 16) |
+            shifted_mask((2 * dst) & 15, 12) |
+            shifted_mask((2 * src) >> 4, 5) |
+            ((2 * src) & 15)
+    );
+}
+
+static void
+neon_shl(int reg, int shift)
+{
+    neon_shift(reg, reg, shift);
+}
+
+static void
+neon_shl_add(int reg, int shift)
+{
+    neon_shift(Q15, reg, shift);
+    neon_add(reg, Q15);
+}
+
+static void
+neon_shl_sub(int reg, int shift)
+{
+    neon_shift(Q15, reg, shift);
+    neon_three(0xF3200840, reg, Q15, reg);
+}
+
+static void
+x86_rex(bool wide, int reg, int rm)
+{
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >= 8) << 2) | (rm >= 8);
+    if (rex != 0x40)
+        write_byte(rex);
+}
+
+static void
+x86_modrm(int mod, int reg, int rm)
+{
+    write_byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void
+x86_mov_val(int reg, int val)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0xB8 + (reg & 7));
+    write_bytes((uint32_t)val, 4);
+}
+
+static void
+x86_mov_pointer(int reg, void * pointer)
+{
+    x86_rex(true, 0, reg);
+    write_byte(0xB8 + (reg & 7));
+    write_bytes((uintptr_t)pointer, 8);
+}
+
+static void
+x86_load(int dst, int src)
+{
+    x86_rex(false, dst, src);
+    write_byte(0x8B);
+    if ((src & 7) == RBP)                                   //[rbp] and [r13] exist only with displacement
+    {
+        x86_modrm(1, dst, src);
+        write_byte(0);
+    }
+    else
+    {
+        x86_modrm(0, dst, src);
+        if ((src & 7) == RSP)                               //[rsp] and [r12] need SIB byte
+            write_byte(0x24);
+    }
+}
+
+static void
+x86_load_var(int reg, void * pointer)
+{
+    x86_mov_pointer(reg, pointer);
+    x86_load(reg, reg);
+}
+
+static void
+x86_mov_reg(int dst, int src)
+{
+    x86_rex(false, src, dst);
+    write_byte(0x89);
+    x86_modrm(3, src, dst);
+}
+
+static void
+x86_load_slot(int reg, int base, int slot)
+{
+    int offset = 4 * slot;
+    if (!offset)
+    {
+        x86_load(reg, base);
+        return;
+    }
+    bool is_short = offset < 128;
+    x86_rex(false, reg, base);
+    write_byte(0x8B);
+    x86_modrm(is_short ? 1 : 2, reg, base);
+    if ((base & 7) == RSP)                                  //[rsp + ...] and [r12 + ...] need SIB byte
+        write_byte(0x24);
+    write_bytes(offset, is_short ? 1 : 4);
+}
+
+static void
+x86_bind_values(int reg)
+{
+    if (reg != RDI)
+        x86_mov_reg64(reg, RDI);
+}
+
+static void
+x86_mov_reg64(int dst, int src)
+{
+    x86_rex(true, src, dst);
+    write_byte(0x89);
+    x86_modrm(3, src, dst);
+}
+
+static void
+x86_add_imm(int reg, int8_t value)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0x83);
+    x86_modrm(3, 0, reg);
+    write_byte(value);
+}
+
+static void
+x86_rex_index(bool wide, int reg, int index, int base)
+{
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >= 8) << 2) | ((index >= 8) << 1) | (base >= 8);
+    if (rex != 0x40)
+        write_byte(rex);
+}
+
+static void
+x86_memory(int reg, int base, int index, int offset)
+{
+    bool has_sib = index >= 0 || (base & 7) == RSP;
+    int mod = 2;
+    if (offset == 0 && (base & 7) != RBP)                   //[rbp] and [r13] exist only with displacement
+        mod = 0;
+    else if (offset >= -128 && offset < 128)
+        mod = 1;
+    x86_modrm(mod, reg, has_sib ? RSP : base);
+    if (has_sib)                                            //scale 4, index rsp means none
+        write_byte((2 << 6) | ((index >= 0 ? index & 7 : RSP) << 3) | (base & 7));
+    if (mod == 1)
+        write_byte(offset);
+    else if (mod == 2)
+        write_bytes(offset, 4);
+}
+
+static void
+x86_load_column(int reg, int slot, int lane)
+{
+    x86_rex_index(true, reg, -1, RBX);                      //mov reg64, [rbx + 8 * slot]
+    write_byte(0x8B);
+    x86_memory(reg, RBX, -1, 8 * slot);
+    x86_rex_index(false, reg, X86_R13, reg);                //mov reg32, [reg + 4 * r13 + 4 * lane]
+    write_byte(0x8B);
+    x86_memory(reg, reg, X86_R13, 4 * lane);
+}
+
+static int
+x86_frame_offset(int call_site)                             //offset of call site results from rsp
+{
+    return 8 * (x86_stack_slots - x86_frame_slots) + 16 * call_site;
+}
+
+static void
+x86_store_lane(int reg, int call_site, int lane)
+{
+    x86_rex_index(false, reg, -1, RSP);
+    write_byte(0x89);
+    x86_memory(reg, RSP, -1, x86_frame_offset(call_site) + 4 * lane);
+}
+
+static void
+x86_store_result(int reg)
+{
+    x86_rex_index(false, reg, X86_R13, RBP);
+    write_byte(0x89);
+    x86_memory(reg, RBP, X86_R13, 0);
+}
+
+static loop_t
+x86_loop_begin(int step)
+{
+    loop_t loop;
+    loop.start = output;
+    x86_mov_reg(RAX, X86_R13);
+    x86_add_imm(RAX, step);
+    x86_rex(false, X86_R12, RAX);                           //cmp eax, r12d
+    write_byte(0x39);
+    x86_modrm(3, X86_R12, RAX);
+    write_bytes(0x8F0F, 2);                                 //jg rel32, patched by x86_loop_end
+    loop.exit = output;
+    write_bytes(0, 4);
+    return loop;
+}
+
+static void
+x86_loop_end(loop_t loop, int step)
+{
+    x86_add_imm(X86_R13, step);
+    write_byte(0xE9);                                       //jmp rel32
+    write_bytes(loop.start - (output + 4), 4);
+    uint8_t * end = output;
+    output = loop.exit;
+    write_bytes(end - (loop.exit + 4), 4);
+    output = end;
+}
+
+static void
+sse_op(uint16_t opcode, int dst, int src)
+{
+    write_byte(0x66);
+    x86_rex(false, dst, src);
+    write_byte(0x0F);
+    if (opcode > 0xFF)
+        write_byte(opcode >> 8);
+    write_byte(opcode & 0xFF);
+    x86_modrm(3, dst, src);
+}
+
+static void
+sse_move(uint8_t opcode, int reg, int base, int index, int offset)
+{
+    write_byte(0xF3);
+    x86_rex_index(false, reg, index, base);
+    write_byte(0x0F);
+    write_byte(opcode);
+    x86_memory(reg, base, index, offset);
+}
+
+static void
+sse_splat(int reg, int val)
+{
+    x86_mov_val(RAX, val);
+    sse_op(0x6E, reg, RAX);                                 //movd reg, eax
+    sse_op(0x70, reg, reg);                                 //pshufd reg, reg, 0
+    write_byte(0);
+}
+
+static void
+sse_load_column(int reg, int slot, int lane)
+{
+    (void)lane;                                             //all lanes are loaded
+    x86_rex_index(true, RAX, -1, RBX);                      //mov rax, [rbx + 8 * slot]
+    write_byte(0x8B);
+    x86_memory(RAX, RBX, -1, 8 * slot);
+    sse_move(0x6F, reg, RAX, X86_R13, 0);
+}
+
+static void
+sse_load_lanes(int reg, int call_site)
+{
+    sse_move(0x6F, reg, RSP, -1, x86_frame_offset(call_site));
+}
+
+static void
+sse_store_result(int reg)
+{
+    sse_move(0x7F, reg, RBP, X86_R13, 0);
+}
+
+static void
+sse_mov(int dst, int src)                                   //movdqa
+{
+    sse_op(0x6F, dst, src);
+}
+
+static void
+sse_push(int reg)
+{
+    write_bytes(0x10EC8348, 4);                             //sub rsp, 16
+    sse_move(0x7F, reg, RSP, -1, 0);
+    x86_stack_slots += 2;
+}
+
+static void
+sse_pop(int reg)
+{
+    sse_move(0x6F, reg, RSP, -1, 0);
+    write_bytes(0x10C48348, 4);                             //add rsp, 16
+    x86_stack_slots -= 2;
+}
+
+static void
+sse_add(int dst, int src)                                   //paddd
+{
+    sse_op(0xFE, dst, src);
+}
+
+static void
+sse_sub(int dst, int src)                                   //psubd
+{
+    sse_op(0xFA, dst, src);
+}
+
+/*
+ * pmulld is SSE4.1, so 32-bit products come from two pmuludq of lanes 0, 2 and 1, 3 with xmm14 as temporary,
+ * src may be the scratch register, it is pair-swapped for the odd lanes and swapped back, so dst == src works too
+ */
+static void
+sse_mul(int dst, int src)
+{
+    sse_op(0x70, XMM14, dst);                               //pshufd xmm14, dst, 0xB1: a1 a0 a3 a2
+    write_byte(0xB1);
+    sse_op(0x70, src, src);                                 //pshufd src, src, 0xB1: b1 b0 b3 b2
+    write_byte(0xB1);
+    sse_op(0xF4, XMM14, src);                               //pmuludq xmm14, src: a1 * b1, a3 * b3
+    sse_op(0x70, src, src);                                 //pshufd src, src, 0xB1: b0 b1 b2 b3
+    write_byte(0xB1);
+    sse_op(0xF4, dst, src);                                 //pmuludq dst, src: a0 * b0, a2 * b2
+    sse_op(0x70, dst, dst);                                 //pshufd dst, dst, 0x08: low halves to lanes 0, 1
+    write_byte(0x08);
+    sse_op(0x70, XMM14, XMM14);                             //pshufd xmm14, xmm14, 0x08
+    write_byte(0x08);
+    sse_op(0x62, dst, XMM14);                               //punpckldq dst, xmm14: interleave
+}
+
+static void
+sse_neg(int reg)
+{
+    sse_op(0xEF, XMM15, XMM15);                             //pxor
+    sse_sub(XMM15, reg);
+    sse_mov(reg, XMM15);
+}
+
+static void
+sse_shl(int reg, int shift)                                 //pslld reg, imm8
+{
+    sse_op(0x72, 6, reg);
+    write_byte(shift);
+}
+
+static void
+sse_shl_add(int reg, int shift)
+{
+    sse_mov(XMM15, reg);
+    sse_shl(XMM15, shift);
+    sse_add(reg, XMM15);
+}
+
+static void
+sse_shl_sub(int reg, int shift)
+{
+    sse_mov(XMM15, reg);
+    sse_shl(XMM15, shift);
+    sse_sub(XMM15, reg);
+    sse_mov(reg, XMM15);
+}
+
+static void
+x86_push(int reg)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0x50 + (reg & 7));
+    ++x86_stack_slots;
+}
+
+static void
+x86_pop(int reg)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0x58 + (reg & 7));
+    --x86_stack_slots;
+}
+
+static void
+x86_add(int dst, int src)
+{
+    x86_rex(false, src, dst);
+    write_byte(0x01);
+    x86_modrm(3, src, dst);
+}
+
+static void
+x86_sub(int dst, int src)
+{
+    x86_rex(false, src, dst);
+    write_byte(0x29);
+    x86_modrm(3, src, dst);
+}
+
+static void
+x86_mul(int dst, int src)
+{
+    x86_rex(false, dst, src);
+    write_byte(0x0F);
+    write_byte(0xAF);
+    x86_modrm(3, dst, src);
+}
+
+static void
+x86_neg(int reg)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0xF7);
+    x86_modrm(3, 3, reg);
+}
+
+static void
+x86_shl(int reg, int shift)
+{
+    x86_rex(false, 0, reg);
+    write_byte(0xC1);
+    x86_modrm(3, 4, reg);
+    write_byte(shift);
+}
+
+static void
+x86_shl_add(int reg, int shift)
+{
+    if (shift > 3)                                          //lea scales only by 2, 4, 8
+    {
+        x86_mov_reg(RAX, reg);
+        x86_shl(RAX, shift);
+        x86_add(reg, RAX);
+        return;
+    }
+    if (reg >= 8)
+        write_byte(0x47);                                   //REX.RXB
+    write_byte(0x8D);
+    bool has_displacement = (reg & 7) == RBP;               //[rbp + ...] and [r13 + ...] exist only with displacement
+    x86_modrm(has_displacement ? 1 : 0, reg, RSP);          //rm = rsp means SIB byte
+    write_byte((shift << 6) | ((reg & 7) << 3) | (reg & 7));
+    if (has_displacement)
+        write_byte(0);
+}
+
+static void
+x86_shl_sub(int reg, int shift)
+{
+    x86_mov_reg(RAX, reg);
+    x86_shl(RAX, shift);
+    x86_sub(RAX, reg);
+    x86_mov_reg(reg, RAX);
+}
+
+static void
+x86_func_call(void * pointer)
+{
+    bool is_aligned = x86_stack_slots % 2 == 0;              //rsp must be 16-byte aligned at call
+    if (!is_aligned)
+        write_bytes(0x08EC8348, 4);                         //sub rsp, 8
+    x86_mov_pointer(RAX, pointer);
+    write_bytes(0xD0FF, 2);                                 //call rax
+    if (!is_aligned)
+        write_bytes(0x08C48348, 4);                         //add rsp, 8
+}
+
+static const int x86_registers[] = {RBX, RBP, X86_R12, X86_R13, X86_R14, X86_R15};
+static const int x86_leaf_registers[] = {RDI, RSI, RDX, RCX, X86_R8, X86_R9, X86_R10, X86_R11};
+static const int x86_argument_registers[] = {RDI, RSI, RDX, RCX, X86_R8, X86_R9};
+static const int sse_registers[] = {XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+                                    XMM8, XMM9, XMM10, XMM11, XMM12, XMM13};
+
+static void
+x86_start_compile(size_t saved_registers)
+{
+    x86_stack_slots = 1;
+    for (size_t i = 0; i < saved_registers; ++i)
+        x86_push(x86_registers[i]);
+}
+
+static void
+x86_finish_compile(size_t saved_registers)
+{
+    while (saved_registers)
+        x86_pop(x86_registers[--saved_registers]);
+    write_byte(0xC3);
+}
+
+static void
+x86_start_batch(size_t call_sites)
+{
+    x86_start_compile(sizeof(x86_registers) / sizeof(x86_registers[0]));
+    x86_mov_reg64(RBX, RDI);
+    x86_mov_reg64(RBP, RSI);
+    x86_mov_reg(X86_R12, RDX);
+    x86_mov_val(X86_R13, 0);
+    if (call_sites)                                         //one more slot keeps rsp 16-byte aligned at calls
+    {
+        write_bytes(0xEC8148, 3);                           //sub rsp, imm32
+        write_bytes(16 * call_sites + 8, 4);
+        x86_stack_slots += 2 * call_sites + 1;
+    }
+    x86_frame_slots = x86_stack_slots;
+}
+
+static void
+x86_finish_batch(size_t call_sites)
+{
+    if (call_sites)
+    {
+        write_bytes(0xC48148, 3);                           //add rsp, imm32
+        write_bytes(16 * call_sites + 8, 4);
+        x86_stack_slots -= 2 * call_sites + 1;
+    }
+    x86_finish_compile(sizeof(x86_registers) / sizeof(x86_registers[0]));
+}
+
+static const backend_t neon_backend = {
+    neon_registers,
+    sizeof(neon_registers) / sizeof(neon_registers[0]),
+    neon_registers,
+    sizeof(neon_registers) / sizeof(neon_registers[0]),
+    NULL,
+    0,
+    Q0,
+    Q15,
+    NULL,
+    NULL,
+    neon_splat,
+    NULL,
+    NULL,
+    NULL,
+    neon_mov,
+    neon_push,
+    neon_pop,
+    neon_add,
+    neon_sub,
+    neon_mul,
+    neon_neg,
+    neon_shl,
+    neon_shl_add,
+    neon_shl_sub,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    neon_load_column,
+    neon_load_lanes,
+    NULL,
+    neon_store_result,
+    NULL
+};
+
+static const backend_t arm_backend = {
+    arm_registers,
+    sizeof(arm_registers) / sizeof(arm_registers[0]),
+    arm_leaf_registers,
+    sizeof(arm_leaf_registers) / sizeof(arm_leaf_registers[0]),
+    arm_argument_registers,
+    sizeof(arm_argument_registers) / sizeof(arm_argument_registers[0]),
+    R0,
+    R12,
+    start_compile,
+    finish_compile,
+    mov_val,
+    arm_load_var,
+    arm_load_slot,
+    arm_bind_values,
+    mov_reg,
+    arm_push,
+    arm_pop,
+    add,
+    sub,
+    mul,
+    rsb_zero,
+    lsl,
+    add_lsl,
+    rsb_lsl,
+    func_call,
+    arm_reserve_arguments,
+    arm_store_argument,
+    arm_release_arguments,
+    4,
+    arm_start_batch,
+    arm_finish_batch,
+    arm_loop_begin,
+    arm_loop_end,
+    arm_load_column,
+    NULL,
+    arm_store_lane,
+    arm_store_result,
+    &neon_backend
+};
+
+static const backend_t sse_backend = {
+    sse_registers,
+    sizeof(sse_registers) / sizeof(sse_registers[0]),
+    sse_registers,
+    sizeof(sse_registers) / sizeof(sse_registers[0]),
+    NULL,
+    0,
+    XMM0,
+    XMM15,
+    NULL,
+    NULL,
+    sse_splat,
+    NULL,
+    NULL,
+    NULL,
+    sse_mov,
+    sse_push,
+    sse_pop,
+    sse_add,
+    sse_sub,
+    sse_mul,
+    sse_neg,
+    sse_shl,
+    sse_shl_add,
+    sse_shl_sub,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    sse_load_column,
+    sse_load_lanes,
+    NULL,
+    sse_store_result,
+    NULL
+};
+
+static const backend_t x86_64_backend = {
+    x86_registers,
+    sizeof(x86_registers) / sizeof(x86_registers[0]),
+    x86_leaf_registers,
+    sizeof(x86_leaf_registers) / sizeof(x86_leaf_registers[0]),
+    x86_argument_registers,
+    sizeof(x86_argument_registers) / sizeof(x86_argument_registers[0]),
+    RAX,
+    RAX,
+    x86_start_compile,
+    x86_finish_compile,
+    x86_mov_val,
+    x86_load_var,
+    x86_load_slot,
+    x86_bind_values,
+    x86_mov_reg,
+    x86_push,
+    x86_pop,
+    x86_add,
+    x86_sub,
+    x86_mul,
+    x86_neg,
+    x86_shl,
+    x86_shl_add,
+    x86_shl_sub,
+    x86_func_call,
+    NULL,                                                   //all MAX_ARGS arguments fit in registers
+    NULL,
+    NULL,
+    4,
+    x86_start_batch,
+    x86_finish_batch,
+    x86_loop_begin,
+    x86_loop_end,
+    x86_load_column,
+    NULL,
+    x86_store_lane,
+    x86_store_result,
+    &sse_backend
+};
+
+static int
+jit_compile_expression(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer,
+        const backend_t * target,
+        binding_t         variables
+)
+{
+    expr = malloc(strlen(expression) + 1);
+    int i = 0;
+    for (int j = 0; expression[j]; ++j)
+        if (expression[j] != ' ')
+            expr[i++] = expression[j];
+    expr[i] = '\0';
+    extern_symbols = externs;
+    output = out_buffer;
+    current_pos = 0;
+    backend = target;
+    binding = variables;
+    nodes = malloc(3 * (i + 1) * sizeof(node_t));
+    nodes_count = 0;
+    is_rejected = false;
+
+    node_t * root = parse_expr(false, false);
+    if (is_rejected)
+    {
+        free(nodes);
+        free(expr);
+        return -1;
+    }
+    root = optimize(root);
+    size_t saved_registers = label(root) + (binding == BIND_VALUES);    //first register of the set keeps bound values
+    if (binding == BIND_COLUMNS)
+    {
+        generate_batch(root);
+        free(nodes);
+        free(expr);
+        return 0;
+    }
+    if (!has_calls(root) && (saved_registers <= backend->leaf_registers_count
+                             || backend->leaf_registers_count >= backend->registers_count))
+    {
+        registers = backend->leaf_registers;
+        registers_count = backend->leaf_registers_count;
+        saved_registers = 0;
+    }
+    else
+    {
+        registers = backend->registers;
+        registers_count = backend->registers_count;
+        if (saved_registers > registers_count)
+            saved_registers = registers_count;
+    }
+    backend->start_compile(saved_registers);
+    if (binding == BIND_VALUES)
+    {
+        values_register = registers[0];
+        backend->bind_values(values_register);
+        ++registers;
+        --registers_count;
+    }
+    generate(root, 0);
+    if (registers[0] != backend->result_register)
+        backend->mov_reg(backend->result_register, registers[0]);
+    backend->finish_compile(saved_registers);
+
+    free(nodes);
+    free(expr);
+    return 0;
+}
+
+//all jit_compile functions return 0, or -1 without writing code if a call has more than MAX_ARGS arguments
+int
+jit_compile_expression_to_arm(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &arm_backend, BIND_ADDRESSES);
+}
+
+int
+jit_compile_expression_to_x86_64(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &x86_64_backend, BIND_ADDRESSES);
+}
+
+//code for the machine this file is built for, so it can be called directly
+int
+jit_compile_expression_to_native(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+#if defined(__x86_64__)
+    return jit_compile_expression_to_x86_64(expression, externs, out_buffer);
+#else
+    return jit_compile_expression_to_arm(expression, externs, out_buffer);
+#endif
+}
+
+
+/*
+ * compiled code is int f(const int * values): variable named externs[i].name is read from values[i]
+ * when f is called, pointers of variable symbols are not used, so one buffer serves any number of bindings
+ */
+int
+jit_compile_bound_expression_to_arm(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &arm_backend, BIND_VALUES);
+}
+
+int
+jit_compile_bound_expression_to_x86_64(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &x86_64_backend, BIND_VALUES);
+}
+
+int
+jit_compile_bound_expression_to_native(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+#if defined(__x86_64__)
+    return jit_compile_bound_expression_to_x86_64(expression, externs, out_buffer);
+#else
+    return jit_compile_bound_expression_to_arm(expression, externs, out_buffer);
+#endif
+}
+
+/*
+ * compiled code is void f(const int * const * columns, int * out, int n): out[row] is the value of expression
+ * for variables externs[i].name = columns[i][row], row < n, pointers of variable symbols are not used
+ * rows are computed BATCH_LANES at once with NEON or SSE2 (every x86-64 CPU has it, no SSE4.1 needed),
+ * extern functions are called for every row
+ */
+int
+jit_compile_batch_expression_to_arm(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &arm_backend, BIND_COLUMNS);
+}
+
+int
+jit_compile_batch_expression_to_x86_64(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+    return jit_compile_expression(expression, externs, out_buffer, &x86_64_backend, BIND_COLUMNS);
+}
+
+int
+jit_compile_batch_expression_to_native(
+        const char      * expression,
+        const symbol_t  * externs,
+        void            * out_buffer
+)
+{
+#if defined(__x86_64__)
+    return jit_compile_batch_expression_to_x86_64(expression, externs, out_buffer);
+#else
+    return jit_compile_batch_expression_to_arm(expression, externs, out_buffer);
+#endif
+}
@@ -11,10 +11,11 @@ typedef struct {
     void       * pointer;
 } symbol_t;
 
-extern void
-jit_compile_expression_to_arm(const char * expression,
-                              const symbol_t * externs,
-                              void * out_buffer);
+// compiles for the host: x86-64 when built for it, 32-bit ARM otherwise, -1 if the expression is rejected
+extern int
+jit_compile_expression_to_native(const char * expression,
+                                 const symbol_t * externs,
+                                 void * out_buffer);
 
 // available functions to be used within JIT-compiled code
 static int my_div(int a, int b) { /*fprintf(stderr, "my_div(%i, %i) called\n", a, b);*/ return a / b; }
@@ -147,10 +148,10 @@ init_program_code_buffer()
     void * result = mmap(0,
                          CODE_SIZE,
                          PROT_READ|PROT_WRITE|PROT_EXEC,
-                         MAP_PRIVATE,
-                         0,
+                         MAP_PRIVATE|MAP_ANONYMOUS,
+                         -1,
                          0);
-    if (!result) {
+    if (MAP_FAILED==result) {
         perror("Can't mmap: ");
         exit(2);
     }
@@ -180,11 +181,12 @@ main()
     read_input(functions_count);
     void * code_buffer = init_program_code_buffer();
 
-    jit_compile_expression_to_arm(expression_to_parse,
-                                  symbols,
-                                  code_buffer);
-
-    call_function_and_print_result(code_buffer);
+    if (jit_compile_expression_to_native(expression_to_parse,
+                                         symbols,
+                                         code_buffer) == 0)
+        call_function_and_print_result(code_buffer);
+    else
+        fprintf(stderr, "can't compile expression\n");
     
     free_symbols(functions_count);
     free_program_code_buffer(code_buffer);